@@ -0,0 +1,292 @@
+/**
+ * FogLAMP SimpleExpression notification rule benchmark
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+/**
+ * Drives the plugin entry points with synthetic notification data and
+ * reports, for each scenario, the evaluations per second, the p50 and
+ * p99 latency and the heap allocations per call, and checks that the
+ * "parseAllocations" metric stays flat once the buffers are warm.
+ *
+ * Usage: simple_expression_benchmark [iterations]
+ */
+
+#include <plugin_api.h>
+#include <config_category.h>
+#include <logger.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+extern "C" {
+PLUGIN_HANDLE	plugin_init(const ConfigCategory& config);
+void		plugin_shutdown(PLUGIN_HANDLE handle);
+bool		plugin_eval(PLUGIN_HANDLE handle, const string& assetValues);
+string		plugin_reason(PLUGIN_HANDLE handle);
+string		plugin_metrics(PLUGIN_HANDLE handle);
+};
+
+// Heap allocations made by the process, the plugin included
+static atomic<unsigned long> allocations(0);
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, memory_order_relaxed);
+	void *p = malloc(size ? size : 1);
+	if (!p)
+	{
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+// Payload variants cycled through, so that values change
+#define PAYLOAD_VARIANTS	64
+
+/**
+ * A benchmark scenario
+ */
+struct Scenario {
+	const char	*name;
+	int		datapoints;
+	int		assets;
+	int		complexity;
+};
+
+/**
+ * Latency and allocation figures of a run
+ */
+struct Result {
+	double		perSecond;
+	double		p50;
+	double		p99;
+	double		allocations;
+};
+
+/**
+ * Return the expression of the given complexity over the datapoints
+ * dp0 to dp(datapoints - 1)
+ */
+static string buildExpression(int complexity, int datapoints)
+{
+	string a = "dp0";
+	string b = "dp" + to_string(1 % datapoints);
+	string c = "dp" + to_string(datapoints - 1);
+
+	switch (complexity)
+	{
+	case 0:
+		return a + " > 50";
+	case 1:
+		return a + " > 50 and " + b + " < 20 or " + c + " >= 75";
+	default:
+		return "sqrt(" + a + " * " + a + " + " + b + " * " + b + ") > 60 and " +
+		       "avg(" + a + ", " + b + ", " + c + ") < 70 or " +
+		       "abs(sin(" + c + ") - cos(" + a + ")) > 1.5";
+	}
+}
+
+/**
+ * Return the configuration of the rule for a scenario
+ */
+static string buildConfig(const Scenario& scenario, const string& expression)
+{
+	string assets;
+	for (int i = 0; i < scenario.assets; i++)
+	{
+		assets += (i ? "," : "") + string("asset") + to_string(i);
+	}
+
+	return "{ \"plugin\" : { \"description\" : \"plugin\", \"type\" : \"string\", "
+			"\"default\" : \"SimpleExpression\", \"value\" : \"SimpleExpression\" }, "
+		"\"asset\" : { \"description\" : \"asset\", \"type\" : \"string\", "
+			"\"default\" : \"\", \"value\" : \"" + assets + "\" }, "
+		"\"expression\" : { \"description\" : \"expression\", \"type\" : \"string\", "
+			"\"default\" : \"\", \"value\" : \"" + expression + "\" }, "
+		"\"combine\" : { \"description\" : \"combine\", \"type\" : \"string\", "
+			"\"default\" : \"All\", \"value\" : \"Any\" } }";
+}
+
+/**
+ * Return a plugin_eval() document for a scenario
+ */
+static string buildPayload(const Scenario& scenario, int variant)
+{
+	string payload = "{ ";
+	for (int a = 0; a < scenario.assets; a++)
+	{
+		payload += (a ? ", " : "") + string("\"asset") + to_string(a) + "\" : { ";
+		for (int d = 0; d < scenario.datapoints; d++)
+		{
+			double value = (rand() % 10000) / 100.0;
+			payload += (d ? ", " : "") + string("\"dp") + to_string(d) +
+				   "\" : " + to_string(value);
+		}
+		payload += " }, \"timestamp_asset" + to_string(a) + "\" : " +
+			   to_string(1500000000 + variant);
+	}
+	payload += " }";
+	return payload;
+}
+
+/**
+ * Return the percentile of sorted latencies
+ */
+static double percentile(const vector<double>& sorted, double p)
+{
+	size_t index = (size_t) (p * (sorted.size() - 1));
+	return sorted[index];
+}
+
+/**
+ * Return the heap allocations made by the plugin parsing buffers
+ */
+static unsigned long parseAllocations(PLUGIN_HANDLE handle)
+{
+	string metrics = plugin_metrics(handle);
+	const char *p = strstr(metrics.c_str(), "\"parseAllocations\": ");
+	return p ? strtoul(p + strlen("\"parseAllocations\": "), NULL, 10) : 0;
+}
+
+/**
+ * Run a scenario: plugin_reason() is called, as the notification
+ * service does, when the rule state changes
+ *
+ * @return	False if parsing allocated once the buffers were warm
+ */
+static bool run(const Scenario& scenario, int iterations)
+{
+	string expression = buildExpression(scenario.complexity, scenario.datapoints);
+	ConfigCategory config("benchmark", buildConfig(scenario, expression));
+	PLUGIN_HANDLE handle = plugin_init(config);
+
+	vector<string> payloads;
+	for (int i = 0; i < PAYLOAD_VARIANTS; i++)
+	{
+		payloads.push_back(buildPayload(scenario, i));
+	}
+
+	vector<double> evalLatency;
+	vector<double> reasonLatency;
+	evalLatency.reserve(iterations);
+	reasonLatency.reserve(iterations);
+	unsigned long evalAllocations = 0;
+	unsigned long reasonAllocations = 0;
+	bool previous = false;
+
+	// Warm up buffers and caches
+	for (int i = 0; i < PAYLOAD_VARIANTS; i++)
+	{
+		plugin_eval(handle, payloads[i]);
+	}
+	unsigned long warmAllocations = parseAllocations(handle);
+
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		const string& payload = payloads[i % PAYLOAD_VARIANTS];
+
+		unsigned long before = allocations.load(memory_order_relaxed);
+		auto t0 = chrono::steady_clock::now();
+		bool eval = plugin_eval(handle, payload);
+		auto t1 = chrono::steady_clock::now();
+		evalAllocations += allocations.load(memory_order_relaxed) - before;
+		evalLatency.push_back(chrono::duration<double, micro>(t1 - t0).count());
+
+		if (eval != previous)
+		{
+			before = allocations.load(memory_order_relaxed);
+			t0 = chrono::steady_clock::now();
+			string reason = plugin_reason(handle);
+			t1 = chrono::steady_clock::now();
+			reasonAllocations += allocations.load(memory_order_relaxed) - before;
+			reasonLatency.push_back(chrono::duration<double, micro>(t1 - t0).count());
+			previous = eval;
+		}
+	}
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// The buffers are warm: parsing must not allocate any more
+	unsigned long parsing = parseAllocations(handle) - warmAllocations;
+	plugin_shutdown(handle);
+
+	sort(evalLatency.begin(), evalLatency.end());
+	sort(reasonLatency.begin(), reasonLatency.end());
+
+	printf("%-24s %4d %3d %12.0f %9.2f %9.2f %9.2f",
+	       scenario.name,
+	       scenario.datapoints,
+	       scenario.assets,
+	       iterations / elapsed,
+	       percentile(evalLatency, 0.50),
+	       percentile(evalLatency, 0.99),
+	       (double) evalAllocations / iterations);
+	if (reasonLatency.empty())
+	{
+		printf(" %9s %9s", "-", "-");
+	}
+	else
+	{
+		printf(" %9.2f %9.2f",
+		       percentile(reasonLatency, 0.50),
+		       (double) reasonAllocations / reasonLatency.size());
+	}
+	printf(" %9lu\n", parsing);
+	return parsing == 0;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+	if (iterations <= 0)
+	{
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	// Keep the plugin logging out of the measures
+	Logger::getLogger()->setMinLevel("warning");
+	srand(1);
+
+	static const Scenario scenarios[] = {
+		{ "simple",		1,	1,	0 },
+		{ "simple",		16,	1,	0 },
+		{ "simple",		256,	1,	0 },
+		{ "compound",		16,	1,	1 },
+		{ "compound",		256,	1,	1 },
+		{ "functions",		16,	1,	2 },
+		{ "functions",		256,	1,	2 },
+		{ "compound/assets",	16,	4,	1 },
+		{ "functions/assets",	256,	4,	2 }
+	};
+
+	printf("%-24s %4s %3s %12s %9s %9s %9s %9s %9s %9s\n",
+	       "scenario", "dps", "ast", "evals/s", "p50 us", "p99 us",
+	       "allocs", "reason us", "r.allocs", "p.allocs");
+	bool flat = true;
+	for (auto &s : scenarios)
+	{
+		flat = run(s, iterations) && flat;
+	}
+
+	return flat ? 0 : 1;
+}
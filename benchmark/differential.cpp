@@ -0,0 +1,1441 @@
+/**
+ * FogLAMP SimpleExpression differential checker
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+/**
+ * Evaluates random rules on random readings through each plugin
+ * evaluation path and compares the results with a reference: the
+ * expressions compiled by exprtk on their own, against a symbol table
+ * holding the values of the latest readings, with the windowed
+ * functions computed from all the samples of their window and the
+ * rule state changes simulated reading by reading.
+ *
+ * The rules, in turn:
+ *
+ *   - a condition the vector kernel supports, possibly throttled
+ *   - a condition calling windowed functions, with holdReadings,
+ *     holdTime, evaluateInterval and evaluateEvery options
+ *   - named expressions: a value, then conditions reading it
+ *   - a condition with a clearExpression and the options above
+ *
+ * The conditions compare the "mode" and "mode2" string datapoints
+ * with literals and with each other. The numeric datapoints sometimes
+ * get a string, which the plugin drops.
+ *
+ * The paths checked, each by its own rule instance, are:
+ *
+ *   eval		plugin_eval(): SAX binding, compile once, change
+ *			detection and the closures once the expression
+ *			is hot
+ *   readings		plugin_eval_readings() with FogLAMP readings
+ *   values		plugin_eval_values(), numeric expressions only
+ *   batch		plugin_eval_batch(): the vector kernel when the
+ *			expression compiles to it
+ *   workers		plugin_eval_batch() with 4 workers
+ *   float		plugin_eval() with the float precision, against
+ *			the reference on the values rounded to float
+ *   float batch	plugin_eval_batch() with the float precision
+ *
+ * The expressions produce NaN and infinite values, through divisions
+ * by zero, sqrt() or log() of negative values and overflows: the
+ * number of invalid results, throttled readings and state changes
+ * reported by plugin_metrics() must match the reference too.
+ *
+ * The plugin keeps running sums for window_avg() and window_stddev(),
+ * which round differently from the reference. A result that a change
+ * of a window value within the rounding bound of the sums would flip
+ * is not compared: the reference then follows both rule states.
+ *
+ * The build sets a low CLOSURE_THRESHOLD so that the closures evaluate
+ * most readings of each rule.
+ *
+ * Usage: simple_expression_differential [expressions [readings [seed]]]
+ *
+ * The exit status is 1 if any result differs.
+ */
+
+#include <plugin_api.h>
+#include <config_category.h>
+#include <logger.h>
+#include <reading.h>
+#include <exprtk.hpp>
+#include <simple_expression.h>
+#include <cerrno>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+using namespace std;
+
+extern "C" {
+PLUGIN_HANDLE	plugin_init(const ConfigCategory& config);
+void		plugin_shutdown(PLUGIN_HANDLE handle);
+bool		plugin_eval(PLUGIN_HANDLE handle, const string& assetValues);
+bool		plugin_eval_readings(PLUGIN_HANDLE handle,
+				     const vector<Reading *>& readings);
+bool		plugin_eval_values(PLUGIN_HANDLE handle,
+				   const SimpleExpressionValue *values,
+				   size_t count,
+				   double timestamp);
+bool		plugin_eval_batch(PLUGIN_HANDLE handle,
+				  const string& readings,
+				  vector<bool>& results);
+string		plugin_metrics(PLUGIN_HANDLE handle);
+};
+
+// Numeric datapoints dp0 to dp(DIFFERENTIAL_DATAPOINTS - 1),
+// plus the "mode" and "mode2" string datapoints
+#define DIFFERENTIAL_DATAPOINTS	4
+#define DIFFERENTIAL_ASSET	"asset0"
+// Timestamp of the first reading, the others follow one per second
+#define DIFFERENTIAL_START	1500000000
+// Windowed function calls per rule
+#define DIFFERENTIAL_WINDOWS	3
+// Rule states the reference follows before giving up
+#define DIFFERENTIAL_STATES	256
+
+static const char *modes[] = { "AUTO", "MANUAL", "FAULT", "auto", "" };
+
+/**
+ * A generated reading: a datapoint missing from the reading keeps
+ * its previous value
+ */
+struct Record {
+	bool		present[DIFFERENTIAL_DATAPOINTS];
+	// False for a string sent to a numeric datapoint, which the
+	// plugin drops: the datapoint keeps its previous value
+	bool		numeric[DIFFERENTIAL_DATAPOINTS];
+	// The JSON text of each value and its double
+	string		text[DIFFERENTIAL_DATAPOINTS];
+	double		value[DIFFERENTIAL_DATAPOINTS];
+	bool		hasMode[2];
+	string		mode[2];
+};
+
+/**
+ * A windowed function call
+ */
+struct Window {
+	enum Function { Avg, Min, Max, StdDev, Rate, Delta };
+	Function	function;
+	int		source;
+	double		seconds;
+	// The call in the plugin expressions
+	string		call;
+};
+
+/**
+ * A generated rule
+ *
+ * The reference texts read the windowed function values from the
+ * variables w0, w1...; the plugin texts have the calls.
+ */
+struct Scenario {
+	// The expression names, none for a single expression
+	vector<string>	names;
+	vector<string>	expressions;
+	vector<bool>	triggers;
+	string		clear;
+	vector<Window>	windows;
+	bool		strings;
+	long		holdReadings;
+	double		holdTime;
+	long		evaluateInterval;
+	long		evaluateEvery;
+
+	// The plugin text of a reference one
+	string	pluginText(const string& text) const
+	{
+		string result;
+		size_t i = 0;
+		while (i < text.length())
+		{
+			bool start = text[i] == 'w' && i + 1 < text.length() &&
+				     isdigit(text[i + 1]) &&
+				     (i == 0 || !(isalnum(text[i - 1]) || text[i - 1] == '_'));
+			if (!start)
+			{
+				result += text[i++];
+				continue;
+			}
+			size_t end = i + 1;
+			while (end < text.length() && isdigit(text[end]))
+			{
+				end++;
+			}
+			result += windows[atoi(text.c_str() + i + 1)].call;
+			i = end;
+		}
+		return result;
+	};
+
+	// The "expression" configuration item
+	string	expression() const
+	{
+		if (names.empty())
+		{
+			return pluginText(expressions[0]);
+		}
+		string list = "[ ";
+		for (size_t i = 0; i < expressions.size(); i++)
+		{
+			list += string(i ? ", " : "") + "{ \"name\" : \"" + names[i] +
+				"\", \"expression\" : \"" + pluginText(expressions[i]) +
+				"\", \"trigger\" : " + (triggers[i] ? "true" : "false") + " }";
+		}
+		return list + " ]";
+	};
+
+	// A description for the differences
+	string	describe() const
+	{
+		string text = "'" + expression() + "'";
+		if (!clear.empty())
+		{
+			text += ", clear '" + clear + "'";
+		}
+		char options[128];
+		snprintf(options, sizeof(options),
+			 ", hold %ld readings %g s, every %ld readings %ld ms",
+			 holdReadings, holdTime, evaluateEvery, evaluateInterval);
+		return text + options;
+	};
+};
+
+/**
+ * Random expression generator over the README operators and functions
+ */
+class Generator
+{
+	public:
+		Generator() : m_strings(false), m_windowed(false) {};
+
+		// A condition, with comparisons the vector kernel
+		// supports if simple is true
+		string	condition(int depth, bool simple)
+		{
+			if (depth <= 0 || rand() % 3 == 0)
+			{
+				return comparison(simple);
+			}
+			switch (rand() % 4)
+			{
+				case 0:
+					return condition(depth - 1, simple) + " and " +
+					       condition(depth - 1, simple);
+				case 1:
+					return condition(depth - 1, simple) + " or " +
+					       condition(depth - 1, simple);
+				case 2:
+					return "not(" + condition(depth - 1, simple) + ")";
+				default:
+					return "(" + condition(depth - 1, simple) + ")";
+			}
+		};
+
+		string	arithmetic(int depth)
+		{
+			if (depth <= 0 || rand() % 4 == 0)
+			{
+				return rand() % 3 ? variable() : constant();
+			}
+			static const char *operators[] = { "+", "-", "*", "/", "%", "^" };
+			static const char *unary[] = { "abs", "sqrt", "floor", "ceil", "round",
+						       "exp", "log", "log10", "sin", "cos",
+						       "tan", "atan", "tanh" };
+			static const char *binary[] = { "min", "max", "pow", "atan2", "hyp", "avg", "sum" };
+			string a = arithmetic(depth - 1);
+			switch (rand() % 4)
+			{
+				case 0:
+				case 1:
+					return "(" + a + " " + operators[rand() % 6] + " " +
+					       arithmetic(depth - 1) + ")";
+				case 2:
+					return string(unary[rand() % 13]) + "(" + a + ")";
+				default:
+					return string(binary[rand() % 7]) + "(" + a + ", " +
+					       arithmetic(depth - 1) + ")";
+			}
+		};
+
+		// Start a rule
+		void	reset()
+		{
+			m_strings = false;
+			m_windowed = false;
+			m_names.clear();
+			m_windows.clear();
+		};
+		// Use windowed function calls in the arithmetic
+		void	setWindowed(bool windowed) { m_windowed = windowed; };
+		// Names the arithmetic can read
+		void	setNames(const vector<string>& names) { m_names = names; };
+
+		// True if the rule compares the mode strings
+		bool	usesStrings() const { return m_strings; };
+		const vector<Window>&
+			getWindows() const { return m_windows; };
+
+	private:
+		string	comparison(bool simple)
+		{
+			static const char *operators[] = { "<", "<=", ">", ">=", "==", "!=", "=", "<>" };
+			string op = operators[rand() % 8];
+			if (rand() % 6 == 0)
+			{
+				m_strings = true;
+				string equal = rand() % 2 ? "==" : "!=";
+				string mode = rand() % 2 ? "mode" : "mode2";
+				switch (rand() % 3)
+				{
+					case 0:
+						return mode + " " + equal + " '" + modes[rand() % 5] + "'";
+					case 1:
+						return string("'") + modes[rand() % 5] + "' " + equal + " " + mode;
+					default:
+						// Two runtime strings
+						return rand() % 2 ? "mode " + equal + " mode2" :
+								    "mode2 " + equal + " mode";
+				}
+			}
+			if (simple)
+			{
+				return rand() % 3 ?
+				       variable() + " " + op + " " + constant() :
+				       rand() % 2 ?
+				       variable() + " " + op + " " + variable() :
+				       constant() + " " + op + " " + variable();
+			}
+			return arithmetic(2) + " " + op + " " + arithmetic(1);
+		};
+
+		string	variable()
+		{
+			if (!m_names.empty() && rand() % 3 == 0)
+			{
+				return m_names[rand() % m_names.size()];
+			}
+			if (m_windowed && rand() % 3 == 0)
+			{
+				return window();
+			}
+			return "dp" + to_string(rand() % DIFFERENTIAL_DATAPOINTS);
+		};
+
+		// A windowed function call, as its reference variable
+		string	window()
+		{
+			if (m_windows.size() >= DIFFERENTIAL_WINDOWS)
+			{
+				return "w" + to_string(rand() % m_windows.size());
+			}
+			static const struct {
+				Window::Function	function;
+				const char		*name;
+			} functions[] = {
+				{ Window::Avg,		"window_avg" },
+				{ Window::Min,		"window_min" },
+				{ Window::Max,		"window_max" },
+				{ Window::StdDev,	"window_stddev" },
+				{ Window::Rate,		"rate" },
+				{ Window::Delta,	"delta" }
+			};
+			static const struct {
+				double		seconds;
+				const char	*text;
+			} durations[] = { { 3, "3s" }, { 10, "10" }, { 60, "1m" } };
+
+			int f = rand() % 6;
+			int d = rand() % 3;
+			Window window;
+			window.function = functions[f].function;
+			window.source = rand() % DIFFERENTIAL_DATAPOINTS;
+			window.seconds = durations[d].seconds;
+			window.call = string(functions[f].name) + "(dp" + to_string(window.source);
+			if (window.function == Window::Rate || window.function == Window::Delta)
+			{
+				window.call += ")";
+			}
+			else
+			{
+				window.call += string(", ") + durations[d].text + ")";
+			}
+			m_windows.push_back(window);
+			return "w" + to_string(m_windows.size() - 1);
+		};
+
+		string	constant()
+		{
+			static const char *constants[] = { "0", "1", "-1", "0.1", "50", "-3.5",
+							   "1e300", "1e-300", "100", "16777217",
+							   "9007199254740993", "0.30000000000000004" };
+			return constants[rand() % 12];
+		};
+
+	private:
+		bool		m_strings;
+		bool		m_windowed;
+		vector<string>	m_names;
+		vector<Window>	m_windows;
+};
+
+/**
+ * Return a random datapoint value, as JSON text and as the double
+ * the JSON parser gives
+ */
+static void randomValue(string& text, double& value)
+{
+	char buffer[64];
+	switch (rand() % 8)
+	{
+		case 0:
+		{
+			static const char *special[] = { "0", "1", "-1", "50", "1e308",
+							 "-1e308", "1e-310", "0.1" };
+			text = special[rand() % 8];
+			value = strtod(text.c_str(), NULL);
+			return;
+		}
+		case 1:
+		{
+			// Integers beyond 2^53, and beyond int64 for uint64
+			static const char *integers[] = { "9007199254740993",
+							  "-9007199254740993",
+							  "18446744073709551615",
+							  "9223372036854775807",
+							  "4294967297" };
+			int i = rand() % 5;
+			text = integers[i];
+			value = i == 2 ? (double) strtoull(text.c_str(), NULL, 10) :
+					 (double) strtoll(text.c_str(), NULL, 10);
+			return;
+		}
+		case 2:
+		{
+			long integer = rand() % 200 - 100;
+			text = to_string(integer);
+			value = (double) integer;
+			return;
+		}
+		default:
+			value = (rand() % 20001 - 10000) / 100.0;
+			snprintf(buffer, sizeof(buffer), "%.17g", value);
+			text = buffer;
+			value = strtod(buffer, NULL);
+			return;
+	}
+}
+
+/**
+ * Return random readings; the first one has all the datapoints, so
+ * that the variables are bound from the first evaluation
+ *
+ * @param    count	The number of readings
+ * @param    windowed	True to make the values that overflow the
+ *			window sums rare, so that most window results
+ *			can be compared
+ */
+static vector<Record> randomReadings(int count, bool windowed)
+{
+	vector<Record> records;
+	for (int r = 0; r < count; r++)
+	{
+		// Repeated readings exercise the change detection
+		if (r > 0 && rand() % 4 == 0)
+		{
+			records.push_back(records.back());
+			continue;
+		}
+		Record record;
+		for (int d = 0; d < DIFFERENTIAL_DATAPOINTS; d++)
+		{
+			record.present[d] = r == 0 || rand() % 5 != 0;
+			do
+			{
+				randomValue(record.text[d], record.value[d]);
+			} while (windowed && fabs(record.value[d]) > 1e300 && rand() % 16 != 0);
+			record.numeric[d] = r == 0 || rand() % 20 != 0;
+			if (!record.numeric[d])
+			{
+				// Also a literal the expressions compare with
+				record.text[d] = rand() % 2 ? "\"N/A\"" : "\"AUTO\"";
+			}
+		}
+		for (int m = 0; m < 2; m++)
+		{
+			record.hasMode[m] = r == 0 || rand() % 3 != 0;
+			record.mode[m] = modes[rand() % 5];
+		}
+		records.push_back(record);
+	}
+	return records;
+}
+
+/**
+ * Return the plugin_eval() document of a reading
+ */
+static string payload(const Record& record, int index)
+{
+	static const char *modeNames[] = { "mode", "mode2" };
+	string json = "{ \"" DIFFERENTIAL_ASSET "\" : { ";
+	for (int d = 0; d < DIFFERENTIAL_DATAPOINTS; d++)
+	{
+		if (record.present[d])
+		{
+			json += "\"dp" + to_string(d) + "\" : " + record.text[d] + ", ";
+		}
+	}
+	for (int m = 0; m < 2; m++)
+	{
+		if (record.hasMode[m])
+		{
+			json += string("\"") + modeNames[m] + "\" : \"" + record.mode[m] + "\", ";
+		}
+	}
+	// A datapoint the expressions never use
+	json += "\"unused\" : 1 }, \"timestamp_" DIFFERENTIAL_ASSET "\" : " +
+		to_string(DIFFERENTIAL_START + index) + " }";
+	return json;
+}
+
+/**
+ * Reference evaluation: exprtk alone on the datapoint values, the
+ * windowed functions from their samples and the rule state changes
+ * as README describes them
+ */
+class Reference
+{
+	public:
+		Reference(const Scenario& scenario, bool singlePrecision) :
+				m_scenario(scenario),
+				m_singlePrecision(singlePrecision),
+				m_compiled(true),
+				m_values(DIFFERENTIAL_DATAPOINTS, 0.0),
+				m_modes(2),
+				m_windowValues(scenario.windows.size(), 0.0),
+				m_windows(scenario.windows.size()),
+				m_results(scenario.names.size(), 0.0),
+				m_expressions(scenario.expressions.size()),
+				m_throttleCount(0),
+				m_throttleStarted(false),
+				m_lastEvaluation(0.0),
+				m_invalid(0),
+				m_throttled(0),
+				m_stateChanges(0),
+				m_invalidKnown(true),
+				m_stateChangesKnown(true),
+				m_lost(false)
+		{
+			for (int d = 0; d < DIFFERENTIAL_DATAPOINTS; d++)
+			{
+				m_symbols.add_variable("dp" + to_string(d), m_values[d]);
+			}
+			m_symbols.add_stringvar("mode", m_modes[0]);
+			m_symbols.add_stringvar("mode2", m_modes[1]);
+			for (size_t i = 0; i < m_windowValues.size(); i++)
+			{
+				m_symbols.add_variable("w" + to_string(i), m_windowValues[i]);
+			}
+			for (size_t i = 0; i < m_results.size(); i++)
+			{
+				m_symbols.add_variable(scenario.names[i], m_results[i]);
+			}
+			m_symbols.add_constants();
+
+			exprtk::parser<double> parser;
+			for (size_t i = 0; i < m_expressions.size(); i++)
+			{
+				m_expressions[i].register_symbol_table(m_symbols);
+				m_compiled = m_compiled &&
+					     parser.compile(scenario.expressions[i], m_expressions[i]);
+			}
+			m_clear.register_symbol_table(m_symbols);
+			if (!scenario.clear.empty())
+			{
+				m_compiled = m_compiled && parser.compile(scenario.clear, m_clear);
+			}
+
+			m_states.push_back(State());
+		};
+
+		bool	isCompiled() const { return m_compiled; };
+
+		/**
+		 * Evaluate the readings and return the expected results:
+		 * 1 for true, 0 for false, -1 if within the rounding of
+		 * the window sums
+		 */
+		vector<int>
+			run(const vector<Record>& records)
+		{
+			vector<int> expected;
+			for (size_t r = 0; r < records.size(); r++)
+			{
+				double now = DIFFERENTIAL_START + r;
+				this->bind(records[r], now);
+				if (this->throttle(now))
+				{
+					m_throttled++;
+				}
+				else
+				{
+					this->step(now);
+				}
+				expected.push_back(this->expected());
+			}
+			return expected;
+		};
+
+		unsigned long
+			getInvalid() const { return m_invalid; };
+		unsigned long
+			getThrottled() const { return m_throttled; };
+		unsigned long
+			getStateChanges() const { return m_stateChanges; };
+		bool	isInvalidKnown() const { return m_invalidKnown; };
+		bool	isStateChangesKnown() const { return m_stateChangesKnown; };
+
+	private:
+		// The rule state
+		struct State {
+			State() : triggered(false), pending(false), count(0), since(0.0) {};
+			bool	operator==(const State& other) const
+			{
+				return triggered == other.triggered &&
+				       pending == other.pending &&
+				       count == other.count &&
+				       since == other.since;
+			};
+			bool	triggered;
+			bool	pending;
+			long	count;
+			double	since;
+		};
+		// The result of an evaluation
+		struct Outcome {
+			bool		eval;
+			unsigned long	invalid;
+		};
+		// The samples of a windowed function
+		struct WindowState {
+			WindowState() : hasPrevious(false),
+					previousTimestamp(0.0),
+					previousValue(0.0),
+					tolerance(0.0),
+					unbounded(false) {};
+			deque<pair<double, double> >	samples;
+			// The finite samples the plugin sums may still hold
+			deque<pair<double, double> >	recent;
+			bool				hasPrevious;
+			double				previousTimestamp;
+			double				previousValue;
+			// Rounding bound of the plugin value, or
+			// unbounded if its sums may overflow
+			double				tolerance;
+			bool				unbounded;
+		};
+
+		// Set the values of a reading and update the windows
+		void	bind(const Record& record, double now)
+		{
+			for (int d = 0; d < DIFFERENTIAL_DATAPOINTS; d++)
+			{
+				if (record.present[d] && record.numeric[d])
+				{
+					m_values[d] = m_singlePrecision ?
+						      (double) (float) record.value[d] :
+						      record.value[d];
+				}
+			}
+			for (int m = 0; m < 2; m++)
+			{
+				if (record.hasMode[m])
+				{
+					m_modes[m] = record.mode[m];
+				}
+			}
+			for (size_t i = 0; i < m_windows.size(); i++)
+			{
+				const Window& window = m_scenario.windows[i];
+				if (record.present[window.source] &&
+				    record.numeric[window.source])
+				{
+					m_windowValues[i] = this->update(window,
+									 m_windows[i],
+									 now,
+									 m_values[window.source]);
+				}
+			}
+		};
+
+		// Add a sample to a window and return the function value
+		double	update(const Window& window,
+			       WindowState& state,
+			       double now,
+			       double value)
+		{
+			state.tolerance = 0.0;
+			state.unbounded = false;
+			if (window.function == Window::Rate || window.function == Window::Delta)
+			{
+				double result = 0.0;
+				if (state.hasPrevious)
+				{
+					result = value - state.previousValue;
+					if (window.function == Window::Rate)
+					{
+						double elapsed = now - state.previousTimestamp;
+						result = elapsed > 0.0 ? result / elapsed : 0.0;
+					}
+				}
+				state.hasPrevious = true;
+				state.previousTimestamp = now;
+				state.previousValue = value;
+				return result;
+			}
+
+			while (!state.samples.empty() &&
+			       state.samples.front().first <= now - window.seconds)
+			{
+				state.samples.pop_front();
+			}
+			while (!state.recent.empty() &&
+			       state.recent.front().first <= now - 3 * window.seconds - 5)
+			{
+				state.recent.pop_front();
+			}
+			if (std::isfinite(value))
+			{
+				state.samples.push_back(make_pair(now, value));
+				state.recent.push_back(make_pair(now, value));
+			}
+			if (state.samples.empty())
+			{
+				return NAN;
+			}
+
+			double result = state.samples.front().second;
+			long double sum = 0.0;
+			for (auto &s : state.samples)
+			{
+				if (window.function == Window::Min)
+				{
+					result = min(result, s.second);
+				}
+				else if (window.function == Window::Max)
+				{
+					result = max(result, s.second);
+				}
+				sum += s.second;
+			}
+			if (window.function == Window::Min || window.function == Window::Max)
+			{
+				return result;
+			}
+
+			long double count = state.samples.size();
+			long double mean = sum / count;
+			long double largest = 0.0;
+			for (auto &s : state.recent)
+			{
+				largest = max(largest, fabsl(s.second));
+			}
+			long double range = 2 * largest;
+			long double terms = state.recent.size();
+			if (window.function == Window::Avg)
+			{
+				state.unbounded = terms * range > DBL_MAX / 2;
+				state.tolerance = 1e-10 * largest;
+				return (double) mean;
+			}
+
+			long double squares = 0.0;
+			for (auto &s : state.samples)
+			{
+				squares += (s.second - mean) * (s.second - mean);
+			}
+			long double deviation = sqrtl(squares / count);
+			long double variance = 1e-12 * range * range;
+			state.unbounded = terms * range * range > DBL_MAX / 2;
+			state.tolerance = deviation > 0.0 ?
+					  min(sqrtl(variance), variance / deviation) :
+					  sqrtl(variance);
+			return (double) deviation;
+		};
+
+		// True if the reading is throttled, as SimpleExpression::throttle()
+		bool	throttle(double now)
+		{
+			if (m_scenario.evaluateEvery > 1 &&
+			    m_throttleCount++ % m_scenario.evaluateEvery != 0)
+			{
+				return true;
+			}
+			if (m_scenario.evaluateInterval > 0)
+			{
+				double interval = m_scenario.evaluateInterval / 1000.0;
+				if (m_throttleStarted &&
+				    now >= m_lastEvaluation &&
+				    now - m_lastEvaluation < interval)
+				{
+					return true;
+				}
+				m_throttleStarted = true;
+				m_lastEvaluation = now;
+			}
+			return false;
+		};
+
+		// Evaluate a reading in each possible rule state
+		void	step(double now)
+		{
+			vector<Outcome> trigger = this->outcomes(false);
+			vector<Outcome> clear;
+			if (!m_scenario.clear.empty())
+			{
+				clear = this->outcomes(true);
+			}
+
+			vector<State> states;
+			vector<unsigned long> invalid, changes;
+			for (auto &s : m_states)
+			{
+				const vector<Outcome>& list = s.triggered && !m_scenario.clear.empty() ?
+							      clear : trigger;
+				for (auto &o : list)
+				{
+					State next = s;
+					bool changed = this->hold(next, o.eval, now);
+					addUnique(states, next);
+					addUnique(invalid, o.invalid);
+					addUnique(changes, (unsigned long) changed);
+				}
+			}
+
+			if (invalid.size() == 1)
+			{
+				m_invalid += invalid[0];
+			}
+			else
+			{
+				m_invalidKnown = false;
+			}
+			if (changes.size() == 1)
+			{
+				m_stateChanges += changes[0];
+			}
+			else
+			{
+				m_stateChangesKnown = false;
+			}
+			if (states.size() > DIFFERENTIAL_STATES)
+			{
+				// Too many histories to follow: nothing
+				// more is compared
+				states.resize(1);
+				m_invalidKnown = false;
+				m_stateChangesKnown = false;
+				m_lost = true;
+			}
+			m_states = states;
+		};
+
+		// The state change of an evaluation, as SimpleExpression::evalRow()
+		bool	hold(State& state, bool eval, double now)
+		{
+			if (eval == state.triggered)
+			{
+				state = State();
+				state.triggered = eval;
+				return false;
+			}
+			now = m_scenario.holdTime > 0.0 ? now : 0.0;
+			if (!state.pending)
+			{
+				state.pending = true;
+				state.count = 0;
+				state.since = now;
+			}
+			state.count++;
+			if (state.count >= m_scenario.holdReadings &&
+			    now - state.since >= m_scenario.holdTime)
+			{
+				state = State();
+				state.triggered = eval;
+				return true;
+			}
+			return false;
+		};
+
+		// The possible results of the expressions, or of the
+		// clear expression, for window values within the
+		// rounding of the plugin sums
+		vector<Outcome>
+			outcomes(bool clear)
+		{
+			vector<Outcome> list;
+			this->addOutcome(list, clear);
+			for (size_t i = 0; i < m_windows.size(); i++)
+			{
+				const WindowState& state = m_windows[i];
+				if (!state.unbounded && state.tolerance == 0.0)
+				{
+					continue;
+				}
+				double value = m_windowValues[i];
+				vector<double> candidates;
+				if (state.unbounded)
+				{
+					candidates = { NAN, INFINITY, -INFINITY };
+				}
+				else
+				{
+					candidates = { value - state.tolerance, value + state.tolerance };
+					if (m_scenario.windows[i].function == Window::StdDev)
+					{
+						candidates[0] = max(candidates[0], 0.0);
+					}
+				}
+				for (double candidate : candidates)
+				{
+					m_windowValues[i] = candidate;
+					this->addOutcome(list, clear);
+				}
+				m_windowValues[i] = value;
+			}
+			return list;
+		};
+
+		void	addOutcome(vector<Outcome>& list, bool clear)
+		{
+			Outcome outcome = { false, 0 };
+			if (clear)
+			{
+				double result = m_clear.value();
+				outcome.invalid = std::isfinite(result) ? 0 : 1;
+				outcome.eval = !(result == 1.0);
+			}
+			else
+			{
+				for (size_t i = 0; i < m_expressions.size(); i++)
+				{
+					double result = m_expressions[i].value();
+					if (i < m_results.size())
+					{
+						m_results[i] = result;
+					}
+					if (!std::isfinite(result))
+					{
+						outcome.invalid++;
+					}
+					if (m_scenario.triggers[i] && result == 1.0)
+					{
+						outcome.eval = true;
+					}
+				}
+			}
+			for (auto &o : list)
+			{
+				if (o.eval == outcome.eval && o.invalid == outcome.invalid)
+				{
+					return;
+				}
+			}
+			list.push_back(outcome);
+		};
+
+		// The notification state if all the rule states agree on it
+		int	expected() const
+		{
+			if (m_lost)
+			{
+				return -1;
+			}
+			for (auto &s : m_states)
+			{
+				if (s.triggered != m_states[0].triggered)
+				{
+					return -1;
+				}
+			}
+			return m_states[0].triggered ? 1 : 0;
+		};
+
+		template<class T> static void
+			addUnique(vector<T>& list, const T& value)
+		{
+			for (auto &v : list)
+			{
+				if (v == value)
+				{
+					return;
+				}
+			}
+			list.push_back(value);
+		};
+
+	private:
+		const Scenario&			m_scenario;
+		bool				m_singlePrecision;
+		bool				m_compiled;
+		// Sized once: the symbol table holds their addresses
+		vector<double>			m_values;
+		vector<string>			m_modes;
+		vector<double>			m_windowValues;
+		vector<WindowState>		m_windows;
+		vector<double>			m_results;
+		exprtk::symbol_table<double>	m_symbols;
+		vector<exprtk::expression<double> >
+						m_expressions;
+		exprtk::expression<double>	m_clear;
+		vector<State>			m_states;
+		long				m_throttleCount;
+		bool				m_throttleStarted;
+		double				m_lastEvaluation;
+		unsigned long			m_invalid;
+		unsigned long			m_throttled;
+		unsigned long			m_stateChanges;
+		bool				m_invalidKnown;
+		bool				m_stateChangesKnown;
+		// True once the states followed exceed DIFFERENTIAL_STATES
+		bool				m_lost;
+};
+
+/**
+ * Return a JSON string value, with the quotes escaped
+ */
+static string escape(const string& text)
+{
+	string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+/**
+ * Return the rule configuration
+ */
+static string buildConfig(const Scenario& scenario,
+			  const string& precision,
+			  int workers)
+{
+	vector<pair<string, string> > items = {
+		{ "plugin", "SimpleExpression" },
+		{ "asset", DIFFERENTIAL_ASSET },
+		{ "expression", scenario.expression() },
+		{ "clearExpression", scenario.clear },
+		{ "holdReadings", to_string(scenario.holdReadings) },
+		{ "holdTime", to_string(scenario.holdTime) },
+		{ "evaluateInterval", to_string(scenario.evaluateInterval) },
+		{ "evaluateEvery", to_string(scenario.evaluateEvery) },
+		{ "precision", precision },
+		{ "workers", to_string(workers) }
+	};
+
+	string config = "{ ";
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		string value = escape(items[i].second);
+		config += (i ? ", \"" : "\"") + items[i].first + "\" : { "
+			  "\"description\" : \"" + items[i].first + "\", "
+			  "\"type\" : \"string\", \"default\" : \"\", "
+			  "\"value\" : \"" + value + "\" }";
+	}
+	return config + " }";
+}
+
+/**
+ * Return a counter of plugin_metrics()
+ */
+static unsigned long metric(PLUGIN_HANDLE handle, const char *name)
+{
+	string metrics = plugin_metrics(handle);
+	string key = string("\"") + name + "\": ";
+	const char *p = strstr(metrics.c_str(), key.c_str());
+	return p ? strtoul(p + key.length(), NULL, 10) : 0;
+}
+
+/**
+ * Compare the results of a path with the reference ones
+ *
+ * @param    compared	Incremented by the number of results compared
+ * @return		The number of differences
+ */
+static unsigned long compare(const char *path,
+			     const Scenario& scenario,
+			     const vector<bool>& results,
+			     const vector<int>& reference,
+			     unsigned long& compared)
+{
+	unsigned long differences = 0;
+	for (size_t r = 0; r < reference.size(); r++)
+	{
+		if (reference[r] < 0)
+		{
+			continue;
+		}
+		compared++;
+		bool expected = reference[r] == 1;
+		if (r >= results.size() || results[r] != expected)
+		{
+			if (!differences)
+			{
+				printf("DIFFERENCE %-12s reading %lu: expected %s in %s\n",
+				       path, (unsigned long) r,
+				       expected ? "true" : "false",
+				       scenario.describe().c_str());
+			}
+			differences++;
+		}
+	}
+	return differences;
+}
+
+/**
+ * Compare a counter of a path with the reference one
+ *
+ * @return	1 if they differ, 0 otherwise
+ */
+static unsigned long compareMetric(const char *path,
+				   const Scenario& scenario,
+				   PLUGIN_HANDLE handle,
+				   const char *name,
+				   unsigned long expected)
+{
+	unsigned long value = metric(handle, name);
+	if (value == expected)
+	{
+		return 0;
+	}
+	printf("DIFFERENCE %-12s %lu %s, expected %lu in %s\n",
+	       path, value, name, expected, scenario.describe().c_str());
+	return 1;
+}
+
+/**
+ * Evaluate the readings one by one with plugin_eval()
+ */
+static vector<bool> evalDocuments(PLUGIN_HANDLE handle, const vector<Record>& records)
+{
+	vector<bool> results;
+	for (size_t r = 0; r < records.size(); r++)
+	{
+		results.push_back(plugin_eval(handle, payload(records[r], r)));
+	}
+	return results;
+}
+
+/**
+ * Return true and the integer if a JSON number is an integer
+ * that a long holds, as the JSON parser of FogLAMP reads it
+ */
+static bool toLong(const string& text, long& integer)
+{
+	char *end;
+	errno = 0;
+	integer = strtol(text.c_str(), &end, 10);
+	return *end == '\0' && errno == 0;
+}
+
+/**
+ * Evaluate the readings one by one with plugin_eval_readings()
+ */
+static vector<bool> evalReadings(PLUGIN_HANDLE handle, const vector<Record>& records)
+{
+	static const char *modeNames[] = { "mode", "mode2" };
+	vector<bool> results;
+	for (size_t r = 0; r < records.size(); r++)
+	{
+		const Record& record = records[r];
+		vector<Datapoint *> datapoints;
+		for (int d = 0; d < DIFFERENTIAL_DATAPOINTS; d++)
+		{
+			if (!record.present[d])
+			{
+				continue;
+			}
+			long integer;
+			if (!record.numeric[d])
+			{
+				string text = record.text[d].substr(1, record.text[d].length() - 2);
+				DatapointValue value(text);
+				datapoints.push_back(new Datapoint("dp" + to_string(d), value));
+			}
+			else if (toLong(record.text[d], integer))
+			{
+				DatapointValue value(integer);
+				datapoints.push_back(new Datapoint("dp" + to_string(d), value));
+			}
+			else
+			{
+				DatapointValue value(record.value[d]);
+				datapoints.push_back(new Datapoint("dp" + to_string(d), value));
+			}
+		}
+		for (int m = 0; m < 2; m++)
+		{
+			if (record.hasMode[m])
+			{
+				DatapointValue value(record.mode[m]);
+				datapoints.push_back(new Datapoint(modeNames[m], value));
+			}
+		}
+		DatapointValue unused((long) 1);
+		datapoints.push_back(new Datapoint("unused", unused));
+
+		Reading reading(DIFFERENTIAL_ASSET, datapoints);
+		struct timeval timestamp;
+		timestamp.tv_sec = DIFFERENTIAL_START + r;
+		timestamp.tv_usec = 0;
+		reading.setUserTimestamp(timestamp);
+		vector<Reading *> readings(1, &reading);
+		results.push_back(plugin_eval_readings(handle, readings));
+	}
+	return results;
+}
+
+/**
+ * Evaluate the readings one by one with plugin_eval_values()
+ */
+static vector<bool> evalValues(PLUGIN_HANDLE handle, const vector<Record>& records)
+{
+	static const char *names[DIFFERENTIAL_DATAPOINTS] = { "dp0", "dp1", "dp2", "dp3" };
+	vector<bool> results;
+	for (size_t r = 0; r < records.size(); r++)
+	{
+		vector<SimpleExpressionValue> values;
+		for (int d = 0; d < DIFFERENTIAL_DATAPOINTS; d++)
+		{
+			if (records[r].present[d] && records[r].numeric[d])
+			{
+				SimpleExpressionValue v = { DIFFERENTIAL_ASSET, names[d], records[r].value[d] };
+				values.push_back(v);
+			}
+		}
+		results.push_back(plugin_eval_values(handle, values.data(), values.size(),
+						     DIFFERENTIAL_START + r));
+	}
+	return results;
+}
+
+/**
+ * Evaluate the readings in one plugin_eval_batch() call
+ */
+static vector<bool> evalBatch(PLUGIN_HANDLE handle, const vector<Record>& records)
+{
+	string batch = "[ ";
+	for (size_t r = 0; r < records.size(); r++)
+	{
+		batch += (r ? ", " : "") + payload(records[r], r);
+	}
+	batch += " ]";
+	vector<bool> results;
+	plugin_eval_batch(handle, batch, results);
+	return results;
+}
+
+/**
+ * Check one rule on all the paths
+ *
+ * @param    compared	Incremented by the number of results compared
+ * @param    total	Incremented by the number of results
+ * @return		The number of differences
+ */
+static unsigned long check(const Scenario& scenario,
+			   const vector<Record>& records,
+			   unsigned long& compared,
+			   unsigned long& total)
+{
+	Reference reference(scenario, false);
+	Reference floatReference(scenario, true);
+	if (!reference.isCompiled())
+	{
+		return 0;
+	}
+	vector<int> expected = reference.run(records);
+	vector<int> floatExpected = floatReference.run(records);
+
+	static const struct {
+		const char	*path;
+		const char	*precision;
+		int		workers;
+		vector<bool>	(*evaluate)(PLUGIN_HANDLE, const vector<Record>&);
+		bool		numericOnly;
+		bool		countsInvalid;
+	} paths[] = {
+		{ "eval",	"double",	1,	evalDocuments,	false,	true },
+		{ "readings",	"double",	1,	evalReadings,	false,	true },
+		{ "values",	"double",	1,	evalValues,	true,	true },
+		{ "batch",	"double",	1,	evalBatch,	false,	false },
+		{ "workers",	"double",	4,	evalBatch,	false,	false },
+		{ "float",	"float",	1,	evalDocuments,	false,	true },
+		{ "float batch", "float",	1,	evalBatch,	false,	false }
+	};
+
+	unsigned long differences = 0;
+	for (auto &p : paths)
+	{
+		if (p.numericOnly && scenario.strings)
+		{
+			continue;
+		}
+		bool single = strcmp(p.precision, "float") == 0;
+		const Reference& r = single ? floatReference : reference;
+		ConfigCategory config("differential",
+				      buildConfig(scenario, p.precision, p.workers));
+		PLUGIN_HANDLE handle = plugin_init(config);
+
+		vector<bool> results = p.evaluate(handle, records);
+		differences += compare(p.path, scenario, results,
+				       single ? floatExpected : expected,
+				       compared);
+		total += records.size();
+
+		if (p.countsInvalid && r.isInvalidKnown())
+		{
+			differences += compareMetric(p.path, scenario, handle,
+						     "invalidResults", r.getInvalid());
+		}
+		differences += compareMetric(p.path, scenario, handle,
+					     "throttledReadings", r.getThrottled());
+		if (r.isStateChangesKnown())
+		{
+			differences += compareMetric(p.path, scenario, handle,
+						     "stateChanges", r.getStateChanges());
+		}
+
+		plugin_shutdown(handle);
+	}
+	return differences;
+}
+
+/**
+ * Generate a rule, the kind depends on its position
+ */
+static Scenario generate(Generator& generator, int position)
+{
+	static const long holdReadings[] = { 1, 1, 2, 3 };
+	static const double holdTimes[] = { 0, 0, 2 };
+	static const long intervals[] = { 0, 0, 1500, 2500 };
+	static const long every[] = { 1, 1, 2, 3 };
+
+	Scenario scenario;
+	scenario.holdReadings = 1;
+	scenario.holdTime = 0;
+	scenario.evaluateInterval = 0;
+	scenario.evaluateEvery = 1;
+
+	generator.reset();
+	int kind = position % 4;
+	switch (kind)
+	{
+		case 0:
+			// The vector kernel, possibly throttled
+			scenario.expressions.push_back(generator.condition(3, true));
+			break;
+		case 1:
+			generator.setWindowed(true);
+			scenario.expressions.push_back(generator.condition(3, false));
+			break;
+		case 2:
+		{
+			// A value, then the conditions reading it
+			generator.setWindowed(position % 8 == 6);
+			scenario.names = { "level", "warning", "alarm" };
+			scenario.expressions.push_back(generator.arithmetic(2));
+			generator.setNames(vector<string>(1, "level"));
+			scenario.expressions.push_back(generator.condition(2, false));
+			scenario.expressions.push_back(generator.condition(2, false));
+			break;
+		}
+		default:
+			generator.setWindowed(position % 8 == 7);
+			scenario.expressions.push_back(generator.condition(3, false));
+			// The clear expression is over the datapoints only
+			generator.setWindowed(false);
+			scenario.clear = generator.condition(2, false);
+			break;
+	}
+	scenario.triggers.assign(scenario.expressions.size(), true);
+	if (!scenario.names.empty())
+	{
+		scenario.triggers[0] = false;
+	}
+	scenario.windows = generator.getWindows();
+	scenario.strings = generator.usesStrings();
+
+	if (kind != 0 || position % 8 == 4)
+	{
+		scenario.evaluateInterval = intervals[rand() % 4];
+		scenario.evaluateEvery = every[rand() % 4];
+	}
+	if (kind != 0)
+	{
+		scenario.holdReadings = holdReadings[rand() % 4];
+		scenario.holdTime = holdTimes[rand() % 3];
+	}
+	return scenario;
+}
+
+int main(int argc, char **argv)
+{
+	int expressions = argc > 1 ? atoi(argv[1]) : 200;
+	int readingCount = argc > 2 ? atoi(argv[2]) : 1500;
+	unsigned int seed = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+	if (expressions <= 0 || readingCount <= 0)
+	{
+		fprintf(stderr, "Usage: %s [expressions [readings [seed]]]\n", argv[0]);
+		return 1;
+	}
+
+	// Invalid results are logged as errors: only count them
+	Logger::getLogger()->setMinLevel("fatal");
+	srand(seed);
+
+	Generator generator;
+	unsigned long differences = 0;
+	unsigned long compared = 0;
+	unsigned long total = 0;
+	int checked = 0;
+	for (int e = 0; e < expressions; e++)
+	{
+		Scenario scenario = generate(generator, e);
+		vector<Record> records = randomReadings(readingCount, !scenario.windows.empty());
+
+		if (Reference(scenario, false).isCompiled())
+		{
+			checked++;
+		}
+		differences += check(scenario, records, compared, total);
+	}
+
+	printf("%d rules, %d readings each, seed %u: %lu difference(s)\n",
+	       checked, readingCount, seed, differences);
+	printf("%lu of %lu results compared, the others are within "
+	       "the rounding of the window sums\n", compared, total);
+#ifdef SIMPLE_EXPRESSION_CLOSURES
+	printf("Expressions were evaluated by closures after %d evaluations\n",
+	       CLOSURE_THRESHOLD);
+#endif
+
+	return differences ? 1 : 0;
+}
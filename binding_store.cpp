@@ -0,0 +1,323 @@
+/**
+ * FogLAMP SimpleExpression persisted variable bindings
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <binding_store.h>
+#include <logger.h>
+#include "version.h"
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace rapidjson;
+
+/**
+ * Return the process wide store
+ */
+BindingStore& BindingStore::getInstance()
+{
+	static BindingStore instance;
+	return instance;
+}
+
+/**
+ * Constructor: locate the bindings file
+ */
+BindingStore::BindingStore() : m_loaded(false),
+				 m_changed(false)
+{
+	const char *data = getenv("FOGLAMP_DATA");
+	const char *root = getenv("FOGLAMP_ROOT");
+	if (data && *data)
+	{
+		m_path = string(data) + "/" BINDING_STORE_FILE;
+	}
+	else if (root && *root)
+	{
+		m_path = string(root) + "/data/" BINDING_STORE_FILE;
+	}
+}
+
+/**
+ * Return the stored variables of a set of expressions
+ *
+ * The binding found becomes the most recently used.
+ *
+ * @param    key	The expressions key
+ * @param    variables	Output variables in slot order
+ * @return		False if the expressions are not known
+ */
+bool BindingStore::find(const string& key, vector<string>& variables)
+{
+	lock_guard<mutex> guard(m_mutex);
+	this->load();
+
+	string versioned = versionedKey(key);
+	auto it = m_bindings.find(hash(versioned));
+	if (it == m_bindings.end() || it->second.key != versioned)
+	{
+		return false;
+	}
+	auto last = m_order.end();
+	if (it->second.position != --last)
+	{
+		m_order.splice(m_order.end(), m_order, it->second.position);
+		m_changed = true;
+	}
+	variables = it->second.variables;
+	return true;
+}
+
+/**
+ * Store the variables of a set of expressions, as the most recently
+ * used binding, replacing any previous one
+ *
+ * @param    key	The expressions key
+ * @param    variables	The variables in slot order
+ */
+void BindingStore::store(const string& key, const vector<string>& variables)
+{
+	if (m_path.empty())
+	{
+		return;
+	}
+
+	lock_guard<mutex> guard(m_mutex);
+	this->load();
+
+	string versioned = versionedKey(key);
+	string h = hash(versioned);
+	auto it = m_bindings.find(h);
+	if (it == m_bindings.end())
+	{
+		Binding& binding = m_bindings[h];
+		binding.position = m_order.insert(m_order.end(), h);
+		it = m_bindings.find(h);
+	}
+	else if (it->second.key == versioned &&
+		 it->second.variables == variables)
+	{
+		return;
+	}
+	else
+	{
+		m_order.splice(m_order.end(), m_order, it->second.position);
+	}
+	it->second.key = versioned;
+	it->second.variables = variables;
+	m_changed = true;
+
+	while (m_order.size() > BINDING_STORE_MAX_ENTRIES)
+	{
+		m_bindings.erase(m_order.front());
+		m_order.pop_front();
+	}
+}
+
+/**
+ * Remove the stored variables of a set of expressions
+ *
+ * @param    key	The expressions key
+ */
+void BindingStore::remove(const string& key)
+{
+	lock_guard<mutex> guard(m_mutex);
+	this->load();
+
+	string versioned = versionedKey(key);
+	auto it = m_bindings.find(hash(versioned));
+	if (it == m_bindings.end() || it->second.key != versioned)
+	{
+		return;
+	}
+	m_order.erase(it->second.position);
+	m_bindings.erase(it);
+	m_changed = true;
+}
+
+/**
+ * Read the bindings file, once. Called with the lock held.
+ *
+ * A missing or invalid file, or a file of another format version,
+ * gives an empty store.
+ */
+void BindingStore::load()
+{
+	if (m_loaded || m_path.empty())
+	{
+		return;
+	}
+	m_loaded = true;
+
+	ifstream file(m_path.c_str());
+	if (!file)
+	{
+		return;
+	}
+	stringstream content;
+	content << file.rdbuf();
+
+	Document doc;
+	if (doc.Parse(content.str().c_str()).HasParseError() ||
+	    !doc.IsObject() ||
+	    !doc.HasMember("version") || !doc["version"].IsInt() ||
+	    !doc.HasMember("bindings") || !doc["bindings"].IsArray())
+	{
+		Logger::getLogger()->warn("Ignoring the invalid bindings file %s",
+					  m_path.c_str());
+		return;
+	}
+	if (doc["version"].GetInt() != BINDING_STORE_VERSION)
+	{
+		Logger::getLogger()->info("Ignoring the bindings file %s of version %d",
+					  m_path.c_str(),
+					  doc["version"].GetInt());
+		return;
+	}
+
+	// Saved from the least to the most recently used
+	for (auto &b : doc["bindings"].GetArray())
+	{
+		if (!b.IsObject() ||
+		    !b.HasMember("key") || !b["key"].IsString() ||
+		    !b.HasMember("variables") || !b["variables"].IsArray())
+		{
+			continue;
+		}
+		Binding binding;
+		binding.key = b["key"].GetString();
+		bool valid = true;
+		for (auto &v : b["variables"].GetArray())
+		{
+			if (!v.IsString())
+			{
+				valid = false;
+				break;
+			}
+			binding.variables.push_back(v.GetString());
+		}
+		string h = hash(binding.key);
+		if (valid && m_bindings.find(h) == m_bindings.end() &&
+		    m_order.size() < BINDING_STORE_MAX_ENTRIES)
+		{
+			binding.position = m_order.insert(m_order.end(), h);
+			m_bindings[h] = binding;
+		}
+	}
+}
+
+/**
+ * Write the bindings file if they changed since the last flush:
+ * a temporary file is renamed over the previous one
+ *
+ * The bindings are serialised with the lock held, the file is written
+ * without it so that compilations looking up bindings do not wait.
+ */
+void BindingStore::flush()
+{
+	if (m_path.empty())
+	{
+		return;
+	}
+
+	lock_guard<mutex> fileGuard(m_fileMutex);
+	string content;
+	{
+		lock_guard<mutex> guard(m_mutex);
+		if (!m_changed)
+		{
+			return;
+		}
+		m_changed = false;
+		content = this->serialise();
+	}
+
+	string temporary = m_path + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "w");
+	bool written = file != NULL;
+	if (file)
+	{
+		written = fwrite(content.c_str(), 1, content.length(), file) ==
+			  content.length();
+		written = fclose(file) == 0 && written;
+	}
+	if (!written || rename(temporary.c_str(), m_path.c_str()) != 0)
+	{
+		Logger::getLogger()->warn("Unable to save the bindings file %s",
+					  m_path.c_str());
+		::remove(temporary.c_str());
+
+		// Try again on the next flush
+		lock_guard<mutex> guard(m_mutex);
+		m_changed = true;
+	}
+}
+
+/**
+ * Return the bindings file content. Called with the lock held.
+ */
+string BindingStore::serialise()
+{
+	StringBuffer buffer;
+	Writer<StringBuffer> writer(buffer);
+	writer.StartObject();
+	writer.Key("version");
+	writer.Int(BINDING_STORE_VERSION);
+	writer.Key("bindings");
+	writer.StartArray();
+	for (auto &h : m_order)
+	{
+		const Binding& binding = m_bindings[h];
+		writer.StartObject();
+		writer.Key("key");
+		writer.String(binding.key.c_str(), binding.key.length());
+		writer.Key("variables");
+		writer.StartArray();
+		for (auto &v : binding.variables)
+		{
+			writer.String(v.c_str(), v.length());
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+	return string(buffer.GetString(), buffer.GetSize());
+}
+
+/**
+ * Return the stored key of a set of expressions: the plugin version
+ * is part of it, so that an upgrade resolves the expressions again
+ */
+string BindingStore::versionedKey(const string& key)
+{
+	return VERSION "\n" + key;
+}
+
+/**
+ * FNV-1a 64 bit hash of a key, as hexadecimal text
+ */
+string BindingStore::hash(const string& key)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < key.length(); i++)
+	{
+		h ^= (unsigned char) key[i];
+		h *= 1099511628211ULL;
+	}
+	char text[17];
+	snprintf(text, sizeof(text), "%016llx", (unsigned long long) h);
+	return text;
+}
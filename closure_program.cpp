@@ -0,0 +1,623 @@
+/**
+ * FogLAMP SimpleExpression compiled closure evaluation
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <closure_program.h>
+#include <algorithm>
+#include <cmath>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+using namespace std;
+
+/*
+ * The operators, with the exprtk semantics: logical and comparison
+ * operators return 1 or 0 and any non zero value is true
+ */
+#define BINARY_OPERATOR(name, expression) \
+	struct name { \
+		static inline double apply(double a, double b) { return expression; } \
+	};
+#define UNARY_OPERATOR(name, expression) \
+	struct name { \
+		static inline double apply(double a) { return expression; } \
+	};
+
+BINARY_OPERATOR(Add,		a + b)
+BINARY_OPERATOR(Subtract,	a - b)
+BINARY_OPERATOR(Multiply,	a * b)
+BINARY_OPERATOR(Divide,		a / b)
+BINARY_OPERATOR(Modulus,	fmod(a, b))
+BINARY_OPERATOR(Less,		a < b ? 1.0 : 0.0)
+BINARY_OPERATOR(LessEqual,	a <= b ? 1.0 : 0.0)
+BINARY_OPERATOR(Greater,	a > b ? 1.0 : 0.0)
+BINARY_OPERATOR(GreaterEqual,	a >= b ? 1.0 : 0.0)
+BINARY_OPERATOR(Equal,		a == b ? 1.0 : 0.0)
+BINARY_OPERATOR(NotEqual,	a != b ? 1.0 : 0.0)
+BINARY_OPERATOR(And,		(a != 0.0 && b != 0.0) ? 1.0 : 0.0)
+BINARY_OPERATOR(Or,		(a != 0.0 || b != 0.0) ? 1.0 : 0.0)
+BINARY_OPERATOR(Minimum,	std::min(a, b))
+BINARY_OPERATOR(Maximum,	std::max(a, b))
+
+UNARY_OPERATOR(Negate,		-a)
+UNARY_OPERATOR(Not,		a != 0.0 ? 0.0 : 1.0)
+UNARY_OPERATOR(Absolute,	std::abs(a))
+UNARY_OPERATOR(SquareRoot,	std::sqrt(a))
+UNARY_OPERATOR(Floor,		std::floor(a))
+UNARY_OPERATOR(Ceiling,		std::ceil(a))
+
+/*
+ * Node evaluation functions: leaves, and operators specialised for
+ * variable and constant operands
+ */
+static double constantNode(const ClosureNode *node)
+{
+	return node->constant;
+}
+
+static double variableNode(const ClosureNode *node)
+{
+	return *node->variable;
+}
+
+template<class Op> static double binaryNode(const ClosureNode *node)
+{
+	return Op::apply(node->left->evaluate(node->left),
+			 node->right->evaluate(node->right));
+}
+
+template<class Op> static double binaryVariables(const ClosureNode *node)
+{
+	return Op::apply(*node->left->variable, *node->right->variable);
+}
+
+template<class Op> static double binaryVariableConstant(const ClosureNode *node)
+{
+	return Op::apply(*node->left->variable, node->right->constant);
+}
+
+template<class Op> static double binaryConstantVariable(const ClosureNode *node)
+{
+	return Op::apply(node->left->constant, *node->right->variable);
+}
+
+template<class Op> static double unaryNode(const ClosureNode *node)
+{
+	return Op::apply(node->left->evaluate(node->left));
+}
+
+template<class Op> static double unaryVariable(const ClosureNode *node)
+{
+	return Op::apply(*node->left->variable);
+}
+
+/**
+ * Recursive descent parser building the closure tree
+ *
+ * The precedence is the exprtk one: or, and, comparison, additive,
+ * multiplicative and unary operators.
+ */
+class ClosureParser
+{
+	public:
+		ClosureParser(const string& expression,
+			      const ClosureProgram::Symbols& symbols,
+			      deque<ClosureNode>& nodes) :
+				m_text(expression.c_str()),
+				m_position(0),
+				m_symbols(symbols),
+				m_nodes(nodes)
+		{
+		};
+
+		const ClosureNode
+			*parse()
+		{
+			Term term;
+			if (!orExpression(term))
+			{
+				return NULL;
+			}
+			skipSpaces();
+			return m_text[m_position] == '\0' ? term.node : NULL;
+		};
+
+	private:
+		/**
+		 * A parsed sub expression: exprtk reassociates
+		 * arithmetic on constants, e.g. (x * 2) * 3, so
+		 * those terms are tracked to leave them to exprtk
+		 */
+		struct Term {
+			const ClosureNode	*node;
+			bool			arithmeticConstant;
+		};
+
+		void	skipSpaces()
+		{
+			while (m_text[m_position] == ' ' ||
+			       m_text[m_position] == '\t' ||
+			       m_text[m_position] == '\r' ||
+			       m_text[m_position] == '\n')
+			{
+				m_position++;
+			}
+		};
+
+		static bool
+			isLetter(char c)
+		{
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+		};
+		static bool
+			isDigit(char c)
+		{
+			return c >= '0' && c <= '9';
+		};
+		static bool
+			isSymbol(char c)
+		{
+			return isLetter(c) || isDigit(c) || c == '_' || c == '.';
+		};
+
+		// Match a case insensitive keyword not followed by a symbol character
+		bool	keyword(const char *word)
+		{
+			skipSpaces();
+			size_t length = strlen(word);
+			if (strncasecmp(m_text + m_position, word, length) != 0 ||
+			    isSymbol(m_text[m_position + length]))
+			{
+				return false;
+			}
+			m_position += length;
+			return true;
+		};
+
+		bool	character(char c)
+		{
+			skipSpaces();
+			if (m_text[m_position] == c)
+			{
+				m_position++;
+				return true;
+			}
+			return false;
+		};
+
+		static bool
+			isConstant(const ClosureNode *node)
+		{
+			return node->evaluate == constantNode;
+		};
+		static bool
+			isVariable(const ClosureNode *node)
+		{
+			return node->evaluate == variableNode;
+		};
+
+		const ClosureNode
+			*node(double (*evaluate)(const ClosureNode *),
+			      const ClosureNode *left,
+			      const ClosureNode *right)
+		{
+			ClosureNode n;
+			n.evaluate = evaluate;
+			n.left = left;
+			n.right = right;
+			n.variable = NULL;
+			n.constant = 0.0;
+			m_nodes.push_back(n);
+			return &m_nodes.back();
+		};
+
+		const ClosureNode
+			*constant(double value)
+		{
+			ClosureNode n;
+			n.evaluate = constantNode;
+			n.left = n.right = NULL;
+			n.variable = NULL;
+			n.constant = value;
+			m_nodes.push_back(n);
+			return &m_nodes.back();
+		};
+
+		template<class Op> bool
+			binary(Term& left, const Term& right, bool arithmetic)
+		{
+			bool leftConstant = isConstant(left.node);
+			bool rightConstant = isConstant(right.node);
+			if (arithmetic &&
+			    ((leftConstant && right.arithmeticConstant) ||
+			     (rightConstant && left.arithmeticConstant)))
+			{
+				return false;
+			}
+
+			Term result;
+			result.arithmeticConstant = arithmetic && (leftConstant || rightConstant);
+			if (leftConstant && rightConstant)
+			{
+				result.node = constant(Op::apply(left.node->constant,
+								 right.node->constant));
+				result.arithmeticConstant = false;
+			}
+			else if (isVariable(left.node) && isVariable(right.node))
+			{
+				result.node = node(binaryVariables<Op>, left.node, right.node);
+			}
+			else if (isVariable(left.node) && rightConstant)
+			{
+				result.node = node(binaryVariableConstant<Op>, left.node, right.node);
+			}
+			else if (leftConstant && isVariable(right.node))
+			{
+				result.node = node(binaryConstantVariable<Op>, left.node, right.node);
+			}
+			else
+			{
+				result.node = node(binaryNode<Op>, left.node, right.node);
+			}
+			left = result;
+			return true;
+		};
+
+		template<class Op> void
+			unary(Term& term)
+		{
+			if (isConstant(term.node))
+			{
+				term.node = constant(Op::apply(term.node->constant));
+			}
+			else if (isVariable(term.node))
+			{
+				term.node = node(unaryVariable<Op>, term.node, NULL);
+			}
+			else
+			{
+				term.node = node(unaryNode<Op>, term.node, NULL);
+			}
+			term.arithmeticConstant = false;
+		};
+
+		bool	orExpression(Term& term)
+		{
+			if (!andExpression(term))
+			{
+				return false;
+			}
+			while (keyword("or"))
+			{
+				Term right;
+				if (!andExpression(right) || !binary<Or>(term, right, false))
+				{
+					return false;
+				}
+			}
+			return true;
+		};
+
+		bool	andExpression(Term& term)
+		{
+			if (!comparison(term))
+			{
+				return false;
+			}
+			while (keyword("and"))
+			{
+				Term right;
+				if (!comparison(right) || !binary<And>(term, right, false))
+				{
+					return false;
+				}
+			}
+			return true;
+		};
+
+		// A single comparison: chained comparisons are left to exprtk
+		bool	comparison(Term& term)
+		{
+			if (!additive(term))
+			{
+				return false;
+			}
+			skipSpaces();
+			const char *p = m_text + m_position;
+			Term right;
+			if (p[0] == '<' && p[1] == '=')
+			{
+				m_position += 2;
+				return additive(right) && binary<LessEqual>(term, right, false);
+			}
+			if ((p[0] == '<' && p[1] == '>') || (p[0] == '!' && p[1] == '='))
+			{
+				m_position += 2;
+				return additive(right) && binary<NotEqual>(term, right, false);
+			}
+			if (p[0] == '>' && p[1] == '=')
+			{
+				m_position += 2;
+				return additive(right) && binary<GreaterEqual>(term, right, false);
+			}
+			if (p[0] == '=')
+			{
+				m_position += p[1] == '=' ? 2 : 1;
+				return additive(right) && binary<Equal>(term, right, false);
+			}
+			if (p[0] == '<')
+			{
+				m_position++;
+				return additive(right) && binary<Less>(term, right, false);
+			}
+			if (p[0] == '>')
+			{
+				m_position++;
+				return additive(right) && binary<Greater>(term, right, false);
+			}
+			return true;
+		};
+
+		bool	additive(Term& term)
+		{
+			if (!multiplicative(term))
+			{
+				return false;
+			}
+			while (true)
+			{
+				Term right;
+				if (character('+'))
+				{
+					if (!multiplicative(right) || !binary<Add>(term, right, true))
+					{
+						return false;
+					}
+				}
+				else if (character('-'))
+				{
+					if (!multiplicative(right) || !binary<Subtract>(term, right, true))
+					{
+						return false;
+					}
+				}
+				else
+				{
+					return true;
+				}
+			}
+		};
+
+		bool	multiplicative(Term& term)
+		{
+			if (!prefix(term))
+			{
+				return false;
+			}
+			while (true)
+			{
+				Term right;
+				if (character('*'))
+				{
+					if (!prefix(right) || !binary<Multiply>(term, right, true))
+					{
+						return false;
+					}
+				}
+				else if (character('/'))
+				{
+					if (!prefix(right) || !binary<Divide>(term, right, true))
+					{
+						return false;
+					}
+				}
+				else if (character('%'))
+				{
+					if (!prefix(right) || !binary<Modulus>(term, right, false))
+					{
+						return false;
+					}
+				}
+				else
+				{
+					return true;
+				}
+			}
+		};
+
+		bool	prefix(Term& term)
+		{
+			if (character('-'))
+			{
+				if (!prefix(term))
+				{
+					return false;
+				}
+				unary<Negate>(term);
+				return true;
+			}
+			if (character('+'))
+			{
+				return prefix(term);
+			}
+			return primary(term);
+		};
+
+		bool	primary(Term& term)
+		{
+			term.arithmeticConstant = false;
+			if (character('('))
+			{
+				return orExpression(term) && character(')');
+			}
+
+			skipSpaces();
+			const char *start = m_text + m_position;
+			if (isLetter(*start))
+			{
+				size_t length = 1;
+				while (isSymbol(start[length]))
+				{
+					length++;
+				}
+				string name(start, length);
+				m_position += length;
+				if (character('('))
+				{
+					return function(name, term);
+				}
+				for (auto &s : m_symbols)
+				{
+					if (strcasecmp(s.first.c_str(), name.c_str()) == 0)
+					{
+						ClosureNode n;
+						n.evaluate = variableNode;
+						n.left = n.right = NULL;
+						n.variable = s.second;
+						n.constant = 0.0;
+						m_nodes.push_back(n);
+						term.node = &m_nodes.back();
+						return true;
+					}
+				}
+				// Constants such as pi are left to exprtk
+				return false;
+			}
+
+			// Decimal numbers only: digits, fraction and exponent
+			size_t length = 0;
+			while (isDigit(start[length]) || start[length] == '.')
+			{
+				length++;
+			}
+			if (!length)
+			{
+				return false;
+			}
+			if (start[length] == 'e' || start[length] == 'E')
+			{
+				length++;
+				if (start[length] == '+' || start[length] == '-')
+				{
+					length++;
+				}
+				if (!isDigit(start[length]))
+				{
+					return false;
+				}
+				while (isDigit(start[length]))
+				{
+					length++;
+				}
+			}
+			if (isLetter(start[length]) || start[length] == '_')
+			{
+				return false;
+			}
+
+			string number(start, length);
+			char *end;
+			double value = strtod(number.c_str(), &end);
+			if (*end != '\0')
+			{
+				return false;
+			}
+			m_position += length;
+			term.node = constant(value);
+			return true;
+		};
+
+		// A function call, the opening parenthesis already matched
+		bool	function(const string& name, Term& term)
+		{
+			bool two = strcasecmp(name.c_str(), "min") == 0 ||
+				   strcasecmp(name.c_str(), "max") == 0;
+			if (!orExpression(term))
+			{
+				return false;
+			}
+			if (two)
+			{
+				Term right;
+				if (!character(',') || !orExpression(right) || !character(')'))
+				{
+					return false;
+				}
+				bool rv = tolower(name[1]) == 'i' ?
+					  binary<Minimum>(term, right, false) :
+					  binary<Maximum>(term, right, false);
+				term.arithmeticConstant = false;
+				return rv;
+			}
+			if (!character(')'))
+			{
+				return false;
+			}
+			if (strcasecmp(name.c_str(), "not") == 0)
+			{
+				unary<Not>(term);
+			}
+			else if (strcasecmp(name.c_str(), "abs") == 0)
+			{
+				unary<Absolute>(term);
+			}
+			else if (strcasecmp(name.c_str(), "sqrt") == 0)
+			{
+				unary<SquareRoot>(term);
+			}
+			else if (strcasecmp(name.c_str(), "floor") == 0)
+			{
+				unary<Floor>(term);
+			}
+			else if (strcasecmp(name.c_str(), "ceil") == 0)
+			{
+				unary<Ceiling>(term);
+			}
+			else
+			{
+				return false;
+			}
+			return true;
+		};
+
+	private:
+		const char			*m_text;
+		size_t				m_position;
+		const ClosureProgram::Symbols&	m_symbols;
+		deque<ClosureNode>&		m_nodes;
+};
+
+/**
+ * Constructor
+ */
+ClosureProgram::ClosureProgram() : m_root(NULL)
+{
+}
+
+/**
+ * Compile an expression to closures
+ *
+ * @param    expression	The expression, as compiled by exprtk
+ * @param    symbols	The variables the expression can reference
+ * @return		False if the expression is not in the
+ *			supported subset
+ */
+bool ClosureProgram::compile(const string& expression, const Symbols& symbols)
+{
+	m_nodes.clear();
+	ClosureParser parser(expression, symbols, m_nodes);
+	m_root = parser.parse();
+	if (!m_root)
+	{
+		m_nodes.clear();
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,896 @@
+/**
+ * FogLAMP SimpleExpression compiled expression cache
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <expression_cache.h>
+#include <binding_store.h>
+#include <logger.h>
+#include <strings.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+using namespace std;
+
+/**
+ * Return true if the expression assigns variables (:=, +=, -=, *=,
+ * /=, %=): its result may then change with the same inputs
+ */
+static bool hasAssignment(const string& expression)
+{
+	bool quoted = false;
+	for (size_t i = 0; i + 1 < expression.length(); i++)
+	{
+		char c = expression[i];
+		if (c == '\'')
+		{
+			quoted = !quoted;
+		}
+		else if (!quoted && expression[i + 1] == '=' &&
+			 strchr(":+-*/%", c) != NULL)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Return the process wide cache
+ */
+ExpressionCache& ExpressionCache::getInstance()
+{
+	static ExpressionCache instance;
+	return instance;
+}
+
+/**
+ * Constructor
+ */
+ExpressionCache::ExpressionCache()
+{
+	m_constants.add_constants();
+}
+
+/**
+ * Return the template of an expression, building it if no
+ * rule is using the expression yet
+ *
+ * @param    expression	The expression text
+ * @return		The shared template
+ */
+shared_ptr<const ExpressionTemplate> ExpressionCache::get(const string& expression)
+{
+	return this->get(vector<string>(1, expression));
+}
+
+/**
+ * Return the template of a set of expressions evaluated on the same
+ * variables, building it if no rule is using the expressions yet
+ *
+ * @param    expressions	The expressions text
+ * @param    names		The expression names, empty entries
+ *				or vector for unnamed expressions
+ * @return			The shared template
+ */
+shared_ptr<const ExpressionTemplate> ExpressionCache::get(const vector<string>& expressions,
+							  const vector<string>& names)
+{
+	vector<string> expressionNames(names);
+	expressionNames.resize(expressions.size());
+
+	// Normalised expressions have no new line
+	string key;
+	for (size_t i = 0; i < expressions.size(); i++)
+	{
+		key += expressionNames[i] + "=" + normalise(expressions[i]) + "\n";
+	}
+
+	lock_guard<mutex> guard(m_mutex);
+
+	auto it = m_templates.find(key);
+	if (it != m_templates.end())
+	{
+		shared_ptr<const ExpressionTemplate> cached = it->second.lock();
+		if (cached)
+		{
+			return cached;
+		}
+	}
+
+	shared_ptr<ExpressionTemplate> created(new ExpressionTemplate(expressions,
+								      expressionNames));
+	created->m_key = key;
+	bool rewritten = true;
+	for (size_t i = 0; rewritten && i < expressions.size(); i++)
+	{
+		rewritten = this->rewriteWindows(*created, i);
+		this->rewriteStrings(*created, i);
+	}
+	created->m_strings.build(created->m_literals);
+	this->collectStringPairs(*created);
+	if (rewritten &&
+	    BindingStore::getInstance().find(key, created->m_variables) &&
+	    this->checkVariables(*created))
+	{
+		// Resolved by a previous run: an Evaluator failing to
+		// compile the expressions discards the template
+		created->m_valid = true;
+		created->m_restored = true;
+	}
+	else if (rewritten)
+	{
+		created->m_variables.clear();
+		this->collectVariables(*created);
+		if (created->m_valid)
+		{
+			BindingStore::getInstance().store(key, created->m_variables);
+		}
+	}
+	created->m_stateless = created->m_windows.empty();
+	for (auto &e : expressions)
+	{
+		if (hasAssignment(e))
+		{
+			created->m_stateless = false;
+		}
+	}
+	if (created->m_valid && created->m_windows.empty() &&
+	    expressions.size() == 1)
+	{
+		// Windowed functions need the readings in order,
+		// they are not evaluated column-wise
+		StringIndex index(false);
+		index.build(created->m_variables);
+		created->m_kernel.compile(created->m_compiledExpressions[0], index);
+	}
+
+	// Drop the templates no rule uses any more
+	for (auto t = m_templates.begin(); t != m_templates.end(); )
+	{
+		if (t->second.expired())
+		{
+			t = m_templates.erase(t);
+		}
+		else
+		{
+			++t;
+		}
+	}
+	m_templates[key] = created;
+
+	return created;
+}
+
+/**
+ * Compile an expression with the shared parser
+ *
+ * @param    expression	The expression text
+ * @param    compiled	The expression, registered to the symbol
+ *			table holding its variables
+ * @param    error	Set to the parser error on failure
+ * @return		True if the compilation succeeded
+ */
+bool ExpressionCache::compile(const string& expression,
+			      exprtk::expression<double>& compiled,
+			      string& error)
+{
+	lock_guard<mutex> guard(m_mutex);
+
+	bool rv = m_parser.compile(expression, compiled);
+	if (!rv)
+	{
+		error = m_parser.error();
+	}
+	return rv;
+}
+
+/**
+ * Drop a template whose restored variables the expressions do not
+ * compile with, and its stored bindings: the next get() of the
+ * expressions resolves the variables again and stores them
+ *
+ * The Evaluators already using the template keep it.
+ *
+ * @param    expression	The template to drop
+ */
+void ExpressionCache::discard(const ExpressionTemplate& expression)
+{
+	lock_guard<mutex> guard(m_mutex);
+
+	auto it = m_templates.find(expression.m_key);
+	if (it != m_templates.end())
+	{
+		shared_ptr<const ExpressionTemplate> cached = it->second.lock();
+		if (!cached || cached.get() == &expression)
+		{
+			m_templates.erase(it);
+		}
+	}
+	BindingStore::getInstance().remove(expression.m_key);
+	Logger::getLogger()->warn("The stored variables of '%s' do not match the "
+				  "expression, resolving them again",
+				  expression.getExpression().c_str());
+}
+
+/**
+ * Return true if the name is in the list: exprtk symbols
+ * are case insensitive
+ */
+static bool hasName(const vector<string>& names, const string& name)
+{
+	for (auto &n : names)
+	{
+		if (strcasecmp(n.c_str(), name.c_str()) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Add a variable name to the list, unless already there
+ */
+static void addName(vector<string>& names, const string& name)
+{
+	if (!hasName(names, name))
+	{
+		names.push_back(name);
+	}
+}
+
+/**
+ * Collapse white space runs outside string literals to a single
+ * space, so that expressions differing only in layout share a template
+ */
+string ExpressionCache::normalise(const string& expression)
+{
+	string key;
+	key.reserve(expression.length());
+
+	bool quoted = false;
+	bool space = false;
+	for (size_t i = 0; i < expression.length(); i++)
+	{
+		char c = expression[i];
+		if (c == '\'')
+		{
+			quoted = !quoted;
+		}
+		if (!quoted && (c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+		{
+			space = true;
+			continue;
+		}
+		if (space && !key.empty())
+		{
+			key += ' ';
+		}
+		space = false;
+		key += c;
+	}
+	return key;
+}
+
+/**
+ * Collect the names of the variables referenced by the expressions
+ *
+ * Each expression is compiled once against a scratch symbol table
+ * with the unknown symbol resolver enabled, so that every undefined
+ * symbol is reported by the parser dependent entity collector.
+ * Called with the cache lock held.
+ *
+ * @param    expression	The template to fill in
+ */
+void ExpressionCache::collectVariables(ExpressionTemplate& expression)
+{
+	typedef exprtk::parser<double>::dependent_entity_collector::symbol_t symbol_t;
+
+	vector<string>& names = expression.m_variables;
+	expression.m_valid = true;
+
+	for (auto &compiled : expression.m_compiledExpressions)
+	{
+		exprtk::symbol_table<double> scratchTable;
+		exprtk::expression<double> scratchExpression;
+		scratchTable.add_constants();
+		scratchExpression.register_symbol_table(scratchTable);
+
+		m_parser.enable_unknown_symbol_resolver();
+		m_parser.dec().collect_variables() = true;
+
+		bool rv = m_parser.compile(compiled, scratchExpression);
+		deque<symbol_t> symbols;
+		if (rv)
+		{
+			m_parser.dec().symbols(symbols);
+		}
+		else
+		{
+			expression.m_error = m_parser.error();
+		}
+
+		m_parser.dec().collect_variables() = false;
+		m_parser.disable_unknown_symbol_resolver();
+
+		if (!rv)
+		{
+			expression.m_valid = false;
+			return;
+		}
+
+		for (auto &s : symbols)
+		{
+			// Skip constants (pi, epsilon, inf), the
+			// windowed function variables and the results
+			// of the named expressions
+			if (m_constants.symbol_exists(s.first) ||
+			    strncasecmp(s.first.c_str(),
+					WINDOW_VARIABLE_PREFIX,
+					strlen(WINDOW_VARIABLE_PREFIX)) == 0 ||
+			    hasName(expression.m_names, s.first))
+			{
+				continue;
+			}
+			addName(names, s.first);
+		}
+	}
+
+	// The datapoints only referenced by windowed functions
+	for (auto &w : expression.m_windows)
+	{
+		addName(names, w.source);
+	}
+}
+
+/**
+ * Check the variables restored from the BindingStore against the
+ * expressions text: each must be a symbol of the expressions, once,
+ * and neither a constant, a windowed function variable nor the
+ * result of a named expression. A stored variable the expressions
+ * no longer reference would never be bound, so the rule would never
+ * trigger. Each windowed function source must be stored: the compiled
+ * expressions only reference the function variable. Another missing
+ * variable makes the Evaluator compilation fail.
+ * Called with the cache lock held.
+ *
+ * @param    expression	The template with the restored variables
+ * @return		True if the variables can be used
+ */
+bool ExpressionCache::checkVariables(const ExpressionTemplate& expression)
+{
+	// The symbols of the expressions, windowed function
+	// sources included, without the string literals
+	vector<string> symbols;
+	vector<string> texts(expression.m_expressions);
+	texts.insert(texts.end(),
+		     expression.m_compiledExpressions.begin(),
+		     expression.m_compiledExpressions.end());
+	for (auto &text : texts)
+	{
+		bool quoted = false;
+		for (size_t i = 0; i < text.length(); )
+		{
+			char c = text[i];
+			if (c == '\'')
+			{
+				quoted = !quoted;
+				i++;
+			}
+			else if (!quoted && (isalpha((unsigned char) c) || c == '_'))
+			{
+				size_t start = i;
+				while (i < text.length() &&
+				       (isalnum((unsigned char) text[i]) ||
+					text[i] == '_' || text[i] == '.'))
+				{
+					i++;
+				}
+				addName(symbols, text.substr(start, i - start));
+			}
+			else if (!quoted && isdigit((unsigned char) c))
+			{
+				// A number, exponent included
+				while (i < text.length() &&
+				       (isalnum((unsigned char) text[i]) || text[i] == '.'))
+				{
+					i++;
+				}
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	vector<string> seen;
+	for (auto &v : expression.m_variables)
+	{
+		if (v.empty() ||
+		    !hasName(symbols, v) ||
+		    hasName(seen, v) ||
+		    m_constants.symbol_exists(v) ||
+		    strncasecmp(v.c_str(),
+				WINDOW_VARIABLE_PREFIX,
+				strlen(WINDOW_VARIABLE_PREFIX)) == 0 ||
+		    hasName(expression.m_names, v))
+		{
+			return false;
+		}
+		seen.push_back(v);
+	}
+	for (auto &w : expression.m_windows)
+	{
+		if (!hasName(seen, w.source))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Remove the leading and trailing white space
+ */
+static string trim(const string& text)
+{
+	size_t first = text.find_first_not_of(" \t\r\n");
+	if (first == string::npos)
+	{
+		return "";
+	}
+	size_t last = text.find_last_not_of(" \t\r\n");
+	return text.substr(first, last - first + 1);
+}
+
+/**
+ * Parse a window duration: a number of seconds, optionally
+ * followed by the s, m or h unit
+ *
+ * @param    text	The duration text
+ * @param    seconds	Output duration in seconds
+ * @return		False if the duration is not valid
+ */
+static bool parseDuration(const string& text, double& seconds)
+{
+	char *end;
+	seconds = strtod(text.c_str(), &end);
+	if (end == text.c_str())
+	{
+		return false;
+	}
+	string unit = trim(end);
+	if (unit == "m")
+	{
+		seconds *= 60;
+	}
+	else if (unit == "h")
+	{
+		seconds *= 3600;
+	}
+	else if (!unit.empty() && unit != "s")
+	{
+		return false;
+	}
+	return seconds > 0.0;
+}
+
+/**
+ * Replace the windowed function calls of the expression,
+ * e.g. window_avg(x, 60s) or rate(x), by the variables the
+ * Evaluator updates with the function values
+ *
+ * Identical calls, in any of the template expressions, share the variable.
+ *
+ * @param    expression	The template to fill in
+ * @param    index	The position of the expression in the template
+ * @return		False if a windowed function call is not valid
+ */
+bool ExpressionCache::rewriteWindows(ExpressionTemplate& expression,
+				     size_t index)
+{
+	const string& text = expression.m_expressions[index];
+	string rewritten;
+	bool quoted = false;
+	size_t i = 0;
+
+	while (i < text.length())
+	{
+		char c = text[i];
+		if (c == '\'')
+		{
+			quoted = !quoted;
+		}
+		bool identifierStart = !quoted && (isalpha(c) || c == '_') &&
+				       (i == 0 || !(isalnum(text[i - 1]) ||
+						    text[i - 1] == '_' ||
+						    text[i - 1] == '.'));
+		if (!identifierStart)
+		{
+			rewritten += c;
+			i++;
+			continue;
+		}
+
+		size_t end = i;
+		while (end < text.length() && (isalnum(text[end]) || text[end] == '_'))
+		{
+			end++;
+		}
+		string name = text.substr(i, end - i);
+		size_t open = text.find_first_not_of(" \t\r\n", end);
+
+		WindowFunctionBase::Type type;
+		bool hasDuration;
+		if (open == string::npos || text[open] != '(' ||
+		    !WindowFunctionBase::parseType(name, type, hasDuration))
+		{
+			rewritten += name;
+			i = end;
+			continue;
+		}
+
+		size_t close = text.find(')', open);
+		if (close == string::npos)
+		{
+			expression.m_error = name + "(): missing ')'";
+			return false;
+		}
+
+		// Arguments: a datapoint name and, for the
+		// time windows, a duration
+		string arguments = text.substr(open + 1, close - open - 1);
+		size_t comma = arguments.find(',');
+		string source = trim(arguments.substr(0, comma));
+
+		double seconds = 0.0;
+		bool valid = !source.empty() &&
+			     source.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
+						      "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+						      "0123456789_.") == string::npos &&
+			     isalpha(source[0]);
+		if (hasDuration)
+		{
+			valid = valid && comma != string::npos &&
+				parseDuration(arguments.substr(comma + 1), seconds);
+		}
+		else
+		{
+			valid = valid && comma == string::npos;
+		}
+		if (!valid)
+		{
+			expression.m_error = name + (hasDuration ?
+						     "(): expected a datapoint name and a duration" :
+						     "(): expected a datapoint name");
+			return false;
+		}
+
+		// Identical calls share the variable
+		string variable;
+		for (auto &w : expression.m_windows)
+		{
+			if (w.type == type && w.seconds == seconds &&
+			    strcasecmp(w.source.c_str(), source.c_str()) == 0)
+			{
+				variable = w.variable;
+				break;
+			}
+		}
+		if (variable.empty())
+		{
+			WindowDefinition window;
+			window.type = type;
+			window.source = source;
+			window.seconds = seconds;
+			window.variable = WINDOW_VARIABLE_PREFIX +
+					  to_string(expression.m_windows.size());
+			expression.m_windows.push_back(window);
+			variable = window.variable;
+		}
+		rewritten += variable;
+		i = close + 1;
+	}
+
+	expression.m_compiledExpressions[index] = rewritten;
+	return true;
+}
+
+/**
+ * Return true if the characters before position are an equality
+ * operator: "==", "!=", "<>" or "=" not part of an assignment
+ */
+static bool equalityBefore(const string& text, size_t position)
+{
+	size_t p = text.find_last_not_of(" \t\r\n", position ? position - 1 : 0);
+	if (position == 0 || p == string::npos)
+	{
+		return false;
+	}
+	char previous = p > 0 ? text[p - 1] : ' ';
+	if (text[p] == '>')
+	{
+		return previous == '<';
+	}
+	return text[p] == '=' &&
+	       (previous == '=' || previous == '!' ||
+		strchr(":<>+-*/%", previous) == NULL);
+}
+
+/**
+ * Return true if the characters from position are an equality
+ * operator: "==", "!=", "<>" or "="
+ */
+static bool equalityAfter(const string& text, size_t position)
+{
+	size_t q = text.find_first_not_of(" \t\r\n", position);
+	if (q == string::npos)
+	{
+		return false;
+	}
+	return text.compare(q, 2, "==") == 0 ||
+	       text.compare(q, 2, "!=") == 0 ||
+	       text.compare(q, 2, "<>") == 0 ||
+	       (text[q] == '=' && (q + 1 == text.length() || text[q + 1] != '='));
+}
+
+/**
+ * Return true for the characters of a variable name
+ */
+static inline bool isNameCharacter(char c)
+{
+	return isalnum((unsigned char) c) || c == '_' || c == '.';
+}
+
+/**
+ * Return the variable compared by the equality operator ending
+ * before position, if the operand is a plain variable name: the
+ * name must follow the start of the expression, a parenthesis,
+ * a comma, a semicolon or a logical operator such as "and"
+ *
+ * @param    text	The expression
+ * @param    position	The position of the string literal
+ * @return		The variable name or an empty string
+ */
+static string operandBefore(const string& text, size_t position)
+{
+	// The operator, one or two characters
+	size_t p = text.find_last_not_of(" \t\r\n", position - 1);
+	if (p > 0 && strchr("=!<", text[p - 1]) != NULL)
+	{
+		p--;
+	}
+	if (p == 0)
+	{
+		return "";
+	}
+	size_t end = text.find_last_not_of(" \t\r\n", p - 1);
+	if (end == string::npos || !isNameCharacter(text[end]))
+	{
+		return "";
+	}
+	size_t start = end;
+	while (start > 0 && isNameCharacter(text[start - 1]))
+	{
+		start--;
+	}
+	if (!isalpha((unsigned char) text[start]) && text[start] != '_')
+	{
+		return "";
+	}
+	size_t previous = start ? text.find_last_not_of(" \t\r\n", start - 1) :
+				  string::npos;
+	if (previous != string::npos && strchr("(,;", text[previous]) == NULL &&
+	    !isalpha((unsigned char) text[previous]))
+	{
+		return "";
+	}
+	return text.substr(start, end - start + 1);
+}
+
+/**
+ * Return the variable compared by the equality operator starting
+ * at position, if the operand is a plain variable name: the name
+ * must precede the end of the expression, a parenthesis, a comma,
+ * a semicolon or a logical operator such as "and"
+ *
+ * @param    text	The expression
+ * @param    position	The position after the string literal
+ * @return		The variable name or an empty string
+ */
+static string operandAfter(const string& text, size_t position)
+{
+	size_t q = text.find_first_not_of(" \t\r\n", position);
+	q += text.compare(q, 2, "==") == 0 ||
+	     text.compare(q, 2, "!=") == 0 ||
+	     text.compare(q, 2, "<>") == 0 ? 2 : 1;
+	size_t start = text.find_first_not_of(" \t\r\n", q);
+	if (start == string::npos ||
+	    (!isalpha((unsigned char) text[start]) && text[start] != '_'))
+	{
+		return "";
+	}
+	size_t end = start;
+	while (end < text.length() && isNameCharacter(text[end]))
+	{
+		end++;
+	}
+	size_t next = text.find_first_not_of(" \t\r\n", end);
+	if (next != string::npos && strchr("),;", text[next]) == NULL &&
+	    !isalpha((unsigned char) text[next]))
+	{
+		return "";
+	}
+	return text.substr(start, end - start);
+}
+
+/**
+ * Replace the string literals compared for equality by their code
+ * in the template string dictionary, and record the variables they
+ * are compared with
+ *
+ * exprtk escapes a quote in a literal with a backslash. Other string
+ * literals are left for exprtk.
+ *
+ * @param    expression	The template to update
+ * @param    index	The expression position
+ */
+void ExpressionCache::rewriteStrings(ExpressionTemplate& expression,
+				     size_t index)
+{
+	string& text = expression.m_compiledExpressions[index];
+	if (text.find('\'') == string::npos)
+	{
+		return;
+	}
+
+	string rewritten;
+	size_t i = 0;
+	while (i < text.length())
+	{
+		if (text[i] != '\'')
+		{
+			rewritten += text[i++];
+			continue;
+		}
+
+		string value;
+		size_t end = i + 1;
+		while (end < text.length() && text[end] != '\'')
+		{
+			if (text[end] == '\\' && end + 1 < text.length())
+			{
+				end++;
+			}
+			value += text[end++];
+		}
+		if (end == text.length())
+		{
+			// Not terminated: exprtk reports the error
+			rewritten.append(text, i, string::npos);
+			break;
+		}
+		end++;
+
+		bool before = equalityBefore(text, i);
+		if (!before && !equalityAfter(text, end))
+		{
+			rewritten.append(text, i, end - i);
+			i = end;
+			continue;
+		}
+		string variable = before ? operandBefore(text, i) :
+					   operandAfter(text, end);
+		if (!variable.empty())
+		{
+			addName(expression.m_stringVariables, variable);
+		}
+
+		size_t code = 0;
+		while (code < expression.m_literals.size() &&
+		       expression.m_literals[code] != value)
+		{
+			code++;
+		}
+		if (code == expression.m_literals.size())
+		{
+			expression.m_literals.push_back(value);
+		}
+		rewritten += " " + to_string(code + 1) + " ";
+		i = end;
+	}
+	text = rewritten;
+}
+
+/**
+ * Record the variables only compared for equality with another
+ * variable, e.g. both sides of "mode == mode2": they may hold the
+ * code of a string. A variable also used anywhere else, in an
+ * arithmetic or a comparison with a number, is a number variable.
+ *
+ * @param    expression	The template to update, with the string
+ *			literals rewritten
+ */
+void ExpressionCache::collectStringPairs(ExpressionTemplate& expression)
+{
+	vector<string> paired;
+	vector<string> others;
+	for (auto &text : expression.m_compiledExpressions)
+	{
+		bool quoted = false;
+		size_t i = 0;
+		while (i < text.length())
+		{
+			char c = text[i];
+			if (c == '\'')
+			{
+				quoted = !quoted;
+			}
+			if (quoted || !(isalpha((unsigned char) c) || c == '_') ||
+			    (i > 0 && isNameCharacter(text[i - 1])))
+			{
+				i++;
+				continue;
+			}
+
+			size_t end = i;
+			while (end < text.length() && isNameCharacter(text[end]))
+			{
+				end++;
+			}
+			string name = text.substr(i, end - i);
+			size_t next = text.find_first_not_of(" \t\r\n", end);
+			if (next != string::npos && text[next] == '(')
+			{
+				// A function
+				i = end;
+				continue;
+			}
+
+			string other;
+			size_t otherStart = 0;
+			if (equalityAfter(text, end))
+			{
+				size_t q = text.find_first_not_of(" \t\r\n", end);
+				q += text.compare(q, 2, "==") == 0 ||
+				     text.compare(q, 2, "!=") == 0 ||
+				     text.compare(q, 2, "<>") == 0 ? 2 : 1;
+				otherStart = text.find_first_not_of(" \t\r\n", q);
+				if (otherStart != string::npos &&
+				    strcasecmp(operandBefore(text, otherStart).c_str(),
+					       name.c_str()) == 0)
+				{
+					other = operandAfter(text, end);
+				}
+			}
+			if (other.empty())
+			{
+				addName(others, name);
+				i = end;
+				continue;
+			}
+			addName(paired, name);
+			addName(paired, other);
+			i = otherStart + other.length();
+		}
+	}
+
+	for (auto &name : paired)
+	{
+		if (!hasName(others, name) &&
+		    !hasName(expression.m_names, name) &&
+		    strncasecmp(name.c_str(), WINDOW_VARIABLE_PREFIX,
+				strlen(WINDOW_VARIABLE_PREFIX)) != 0)
+		{
+			expression.m_stringPairVariables.push_back(name);
+		}
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef _BINDING_STORE_H
+#define _BINDING_STORE_H
+/*
+ * FogLAMP SimpleExpression persisted variable bindings
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Name of the bindings file in the FogLAMP data directory
+#define BINDING_STORE_FILE		"simple_expression_bindings.json"
+// Bindings kept, the least recently used are dropped first
+#define BINDING_STORE_MAX_ENTRIES	1024
+// Format of the bindings file, a file of another format is ignored
+#define BINDING_STORE_VERSION		1
+
+/**
+ * The variables, in slot order, resolved for each set of expressions,
+ * kept across restarts
+ *
+ * Resolving the variables of an expression takes an exprtk
+ * compilation with the unknown symbol resolver: with the stored
+ * bindings a restarted service skips it for the expressions it
+ * already knows. The bindings are keyed by a hash of the plugin
+ * version and the expressions, as the ExpressionCache keys its
+ * templates, and the key itself is stored to rule out collisions:
+ * the bindings of another plugin version are never used.
+ *
+ * store() and remove() only change the bindings in memory, flush()
+ * writes them: the caller flushes once per configuration, outside
+ * of any compilation, and the file is written without the lock
+ * find() takes.
+ *
+ * The file is in $FOGLAMP_DATA, or $FOGLAMP_ROOT/data, and is read
+ * on first use. Without either variable nothing is persisted.
+ */
+class BindingStore
+{
+	public:
+		static BindingStore&
+			getInstance();
+
+		bool	find(const std::string& key,
+			     std::vector<std::string>& variables);
+		void	store(const std::string& key,
+			      const std::vector<std::string>& variables);
+		void	remove(const std::string& key);
+		void	flush();
+
+	private:
+		BindingStore();
+		void	load();
+		std::string
+			serialise();
+		static std::string
+			versionedKey(const std::string& key);
+		static std::string
+			hash(const std::string& key);
+
+	private:
+		struct Binding {
+			std::string			key;
+			std::vector<std::string>	variables;
+			// Position in m_order
+			std::list<std::string>::iterator
+							position;
+		};
+		std::mutex				m_mutex;
+		// Serialises the writers of the file
+		std::mutex				m_fileMutex;
+		std::string				m_path;
+		bool					m_loaded;
+		// True if the bindings changed since the last flush
+		bool					m_changed;
+		std::map<std::string, Binding>		m_bindings;
+		// Hashes from the least to the most recently used
+		std::list<std::string>			m_order;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _CLOSURE_PROGRAM_H
+#define _CLOSURE_PROGRAM_H
+/*
+ * FogLAMP SimpleExpression compiled closure evaluation
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Evaluations by exprtk before an expression is compiled to closures
+#ifndef CLOSURE_THRESHOLD
+#define CLOSURE_THRESHOLD	1000
+#endif
+// Evaluations comparing the closure and exprtk results before
+// the closures replace exprtk
+#ifndef CLOSURE_VERIFICATIONS
+#define CLOSURE_VERIFICATIONS	100
+#endif
+
+/**
+ * A node of a closure tree: the function evaluating the node is
+ * chosen at compile time for the operator and the kind of operands,
+ * so that variable and constant leaves are read in place
+ */
+struct ClosureNode {
+	double		(*evaluate)(const ClosureNode *node);
+	const ClosureNode
+			*left;
+	const ClosureNode
+			*right;
+	const double	*variable;
+	double		constant;
+};
+
+/**
+ * An expression compiled to a tree of closures over the Evaluator
+ * variables, for the common exprtk operator subset: arithmetic
+ * (+, -, *, /, %), comparisons, and, or, not() and the abs, sqrt,
+ * floor, ceil, min and max functions.
+ *
+ * Expressions outside the subset, and patterns exprtk rewrites when
+ * it optimises an expression, are not compiled and stay with exprtk.
+ */
+class ClosureProgram
+{
+	public:
+		// The variables the expression can read, by name
+		typedef std::vector<std::pair<std::string, const double *> >
+			Symbols;
+
+		ClosureProgram();
+
+		bool	compile(const std::string& expression,
+				const Symbols& symbols);
+		double	evaluate() const { return m_root->evaluate(m_root); };
+
+	private:
+		ClosureProgram(const ClosureProgram&);
+		ClosureProgram&	operator=(const ClosureProgram&);
+
+	private:
+		// Node addresses are stable as the tree grows
+		std::deque<ClosureNode>	m_nodes;
+		const ClosureNode	*m_root;
+};
+
+#endif
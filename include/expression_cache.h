@@ -0,0 +1,191 @@
+#ifndef _EXPRESSION_CACHE_H
+#define _EXPRESSION_CACHE_H
+/*
+ * FogLAMP SimpleExpression compiled expression cache
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <exprtk.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vector_kernel.h>
+#include <window_function.h>
+
+// Prefix of the variables holding the windowed function values
+#define WINDOW_VARIABLE_PREFIX	"window__"
+
+/**
+ * A windowed function call of an expression, replaced in the
+ * compiled expression by a variable holding its value
+ */
+struct WindowDefinition {
+	WindowFunctionBase::Type	type;
+	std::string		source;
+	double			seconds;
+	std::string		variable;
+};
+
+/**
+ * What is known about an expression before binding it to variables:
+ * the variables it references, in slot order, its windowed function
+ * calls and its vector kernel program. An ExpressionTemplate is
+ * immutable and shared by all the Evaluators of the process using
+ * the same expression.
+ *
+ * A template may hold several expressions evaluated on the same
+ * variables, e.g. the trigger and clear expressions of a rule: the
+ * variables and windowed functions are those of all the expressions.
+ * Expressions may be named: the name is the variable holding the
+ * expression result, which the other expressions can read, so it is
+ * not one of the template variables.
+ *
+ * The string literals compared for equality, as in
+ * "status == 'FAULT'", are replaced by their code in the template
+ * string dictionary, from 1, and the variables compared with them are
+ * string variables: string datapoints are bound to the code of their
+ * value, the Evaluators give the other values codes of their own
+ * beyond the literal ones, and compared as numbers. The variables only
+ * compared for equality with each other, as in "mode == mode2", take
+ * string values too; strings are not bound to any other variable.
+ */
+class ExpressionTemplate
+{
+	public:
+		ExpressionTemplate(const std::vector<std::string>& expressions,
+				   const std::vector<std::string>& names) :
+				m_expressions(expressions),
+				m_names(names),
+				m_compiledExpressions(expressions),
+				m_valid(false),
+				m_stateless(false),
+				m_restored(false),
+				m_strings(true)
+		{
+		};
+
+		size_t	getExpressionCount() const { return m_expressions.size(); };
+		const std::string&
+			getExpression(size_t index = 0) const
+			{
+				return m_expressions[index];
+			};
+		// The expression result variable, empty if not named
+		const std::string&
+			getName(size_t index) const
+			{
+				return m_names[index];
+			};
+		// The expression to compile: the windowed function
+		// calls are replaced by their variables
+		const std::string&
+			getCompiledExpression(size_t index = 0) const
+			{
+				return m_compiledExpressions[index];
+			};
+		bool	isValid() const { return m_valid; };
+		// True if the variables come from the BindingStore
+		bool	isRestored() const { return m_restored; };
+		// True if the results only depend on the variable values:
+		// no windowed function and no assignment
+		bool	isStateless() const { return m_stateless; };
+		const std::string&
+			getError() const { return m_error; };
+		const std::vector<std::string>&
+			getVariables() const { return m_variables; };
+		const std::vector<WindowDefinition>&
+			getWindows() const { return m_windows; };
+		// Only for a single expression without windowed functions
+		const VectorKernel&
+			getKernel() const { return m_kernel; };
+		// The code of a literal string, 0 for other values
+		double	internString(const char *value, size_t length) const
+			{
+				return m_strings.find(value, length) + 1;
+			};
+		size_t	getLiteralCount() const { return m_literals.size(); };
+		// The variables compared with string literals
+		const std::vector<std::string>&
+			getStringVariables() const { return m_stringVariables; };
+		// The variables only compared for equality with other
+		// variables
+		const std::vector<std::string>&
+			getStringPairVariables() const { return m_stringPairVariables; };
+
+	private:
+		friend class ExpressionCache;
+
+		std::vector<std::string>	m_expressions;
+		std::vector<std::string>	m_names;
+		std::vector<std::string>	m_compiledExpressions;
+		bool				m_valid;
+		bool				m_stateless;
+		bool				m_restored;
+		// The cache and BindingStore key
+		std::string			m_key;
+		std::string			m_error;
+		std::vector<std::string>	m_variables;
+		std::vector<WindowDefinition>	m_windows;
+		VectorKernel			m_kernel;
+		// Compared literals, the code is the position plus 1
+		std::vector<std::string>	m_literals;
+		std::vector<std::string>	m_stringVariables;
+		std::vector<std::string>	m_stringPairVariables;
+		StringIndex			m_strings;
+};
+
+/**
+ * Process wide cache of ExpressionTemplates, keyed by the expressions
+ * text with the white space normalised, and owner of the exprtk parser
+ * shared by all the rule instances.
+ *
+ * Rules using the same expression, or one expression on many assets,
+ * share the template; each Evaluator keeps its own symbol table,
+ * variables and compiled expression, which exprtk binds to the
+ * variable storage. Templates no rule uses any more are dropped.
+ */
+class ExpressionCache
+{
+	public:
+		static ExpressionCache&
+			getInstance();
+
+		std::shared_ptr<const ExpressionTemplate>
+			get(const std::string& expression);
+		std::shared_ptr<const ExpressionTemplate>
+			get(const std::vector<std::string>& expressions,
+			    const std::vector<std::string>& names =
+				std::vector<std::string>());
+		bool	compile(const std::string& expression,
+				exprtk::expression<double>& compiled,
+				std::string& error);
+		void	discard(const ExpressionTemplate& expression);
+
+	private:
+		ExpressionCache();
+		static std::string
+			normalise(const std::string& expression);
+		bool	rewriteWindows(ExpressionTemplate& expression,
+				       size_t index);
+		void	rewriteStrings(ExpressionTemplate& expression,
+				       size_t index);
+		void	collectStringPairs(ExpressionTemplate& expression);
+		void	collectVariables(ExpressionTemplate& expression);
+		bool	checkVariables(const ExpressionTemplate& expression);
+
+	private:
+		std::mutex		m_mutex;
+		exprtk::parser<double>	m_parser;
+		exprtk::symbol_table<double>
+					m_constants;
+		std::map<std::string, std::weak_ptr<const ExpressionTemplate> >
+					m_templates;
+};
+
+#endif
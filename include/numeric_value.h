@@ -0,0 +1,49 @@
+#ifndef _NUMERIC_VALUE_H
+#define _NUMERIC_VALUE_H
+/*
+ * FogLAMP SimpleExpression numeric datapoint values
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <datapoint.h>
+#include <stdint.h>
+
+/*
+ * Conversion of the numeric datapoint values to the double the
+ * expressions use. The plugin_eval() SAX handler and the Reading
+ * datapoints of plugin_eval_readings() both convert through these
+ * functions, so a value gives the same double whichever the input
+ * path: integers, int64 and uint64 included, are rounded to the
+ * nearest double, never truncated.
+ */
+inline double toNumber(int64_t value) { return (double) value; }
+inline double toNumber(uint64_t value) { return (double) value; }
+inline double toNumber(double value) { return value; }
+
+/**
+ * Convert a Reading datapoint value
+ *
+ * @param    value	The datapoint value
+ * @param    number	Output number
+ * @return		False if the value is not a number
+ */
+inline bool toNumber(DatapointValue& value, double& number)
+{
+	switch (value.getType())
+	{
+		case DatapointValue::T_FLOAT:
+			number = toNumber(value.toDouble());
+			return true;
+		case DatapointValue::T_INTEGER:
+			number = toNumber((int64_t) value.toInt());
+			return true;
+		default:
+			return false;
+	}
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _PARSE_CONTEXT_H
+#define _PARSE_CONTEXT_H
+/*
+ * FogLAMP SimpleExpression parse context
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <rapidjson/reader.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * rapidjson allocator that counts the heap allocations it makes
+ */
+class CountingAllocator
+{
+	public:
+		static const bool kNeedFree = true;
+
+		CountingAllocator() : m_allocations(0) {};
+		void	*Malloc(size_t size)
+		{
+			if (!size)
+			{
+				return NULL;
+			}
+			m_allocations++;
+			return malloc(size);
+		};
+		void	*Realloc(void *ptr, size_t, size_t newSize)
+		{
+			if (!newSize)
+			{
+				free(ptr);
+				return NULL;
+			}
+			m_allocations++;
+			return realloc(ptr, newSize);
+		};
+		static void
+			Free(void *ptr) { free(ptr); };
+		uint64_t
+			getAllocations() const { return m_allocations; };
+
+	private:
+		uint64_t	m_allocations;
+};
+
+/**
+ * Per rule parsing state reused by every plugin_eval() call
+ *
+ * The notification data is copied into a buffer that only grows
+ * and is parsed in situ, so member names are decoded in place and
+ * never copied. The reader and its stack are kept as well: once
+ * the buffers have reached the size of the largest payload seen
+ * no heap allocation is made by parsing.
+ */
+class ParseContext
+{
+	public:
+		typedef rapidjson::GenericReader<rapidjson::UTF8<>,
+						 rapidjson::UTF8<>,
+						 CountingAllocator> Reader;
+
+		ParseContext();
+
+		char	*load(const std::string& data);
+		Reader&	getReader() { return m_reader; };
+		// Heap allocations made by parsing since the rule was created
+		uint64_t
+			getAllocations() const
+			{
+				return m_allocator.getAllocations() + m_bufferAllocations;
+			};
+
+	private:
+		CountingAllocator	m_allocator;
+		Reader			m_reader;
+		std::vector<char>	m_buffer;
+		uint64_t		m_bufferAllocations;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef _READING_HANDLER_H
+#define _READING_HANDLER_H
+/*
+ * FogLAMP SimpleExpression reading handler
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <rapidjson/reader.h>
+#include <simple_expression.h>
+#include <numeric_value.h>
+
+/**
+ * rapidjson SAX handler for the plugin_eval() notification data
+ *
+ * The data is scanned once: numeric datapoints of the configured
+ * assets are written straight into the Evaluator variable slots,
+ * string datapoints as the code of their value, and
+ * the "timestamp_<asset>" values are picked up along the way.
+ * Assets, datapoints and nested values not configured are skipped.
+ *
+ * The handler parses either a single notification data object or,
+ * in batch mode, an array of them: each reading is handed to the
+ * rule when its object ends, see SimpleExpression::batchReading().
+ */
+class ReadingHandler :
+	public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, ReadingHandler>
+{
+	public:
+		ReadingHandler(SimpleExpression& rule,
+			       SimpleExpression::RuleState& state,
+			       std::vector<bool> *results = NULL) :
+				m_rule(rule),
+				m_state(state),
+				m_results(results),
+				m_assetCount(state.assetNames.size()),
+				m_readingDepth(results ? 2 : 1),
+				m_depth(0),
+				m_key(-1),
+				m_asset(-1),
+				m_slot(-1),
+				m_used(0),
+				m_dropped(0)
+		{
+			resetInputs();
+		};
+
+		// Datapoints of the configured assets not used
+		unsigned long
+			getDropped() { return m_dropped; };
+
+		bool	Default()
+		{
+			m_key = -1;
+			m_slot = -1;
+			return true;
+		};
+		bool	Int(int i) { return Number(toNumber((int64_t) i)); };
+		bool	Uint(unsigned u) { return Number(toNumber((uint64_t) u)); };
+		bool	Int64(int64_t i) { return Number(toNumber(i)); };
+		bool	Uint64(uint64_t u) { return Number(toNumber(u)); };
+		bool	Double(double d) { return Number(toNumber(d)); };
+		bool	String(const char *str, rapidjson::SizeType length, bool)
+		{
+			// A string is only bound to a variable compared
+			// with strings, others are dropped as before
+			if (m_depth == m_readingDepth + 1 &&
+			    m_asset >= 0 && m_slot >= 0 &&
+			    m_state.evaluators[m_asset]->takesStrings(m_slot))
+			{
+				SimpleExpression::Evaluator& evaluator = *m_state.evaluators[m_asset];
+				evaluator.setVariable(m_slot, evaluator.internString(str, length));
+				m_used++;
+			}
+			return Default();
+		};
+
+		bool	Key(const char *str, rapidjson::SizeType length, bool)
+		{
+			if (m_depth == m_readingDepth)
+			{
+				// Asset name or timestamp_<asset>
+				m_key = m_state.assetIndex.find(str, length);
+			}
+			else if (m_depth == m_readingDepth + 1 && m_asset >= 0)
+			{
+				m_slot = m_state.evaluators[m_asset]->findVariable(str, length);
+			}
+			return true;
+		};
+
+		bool	StartObject()
+		{
+			m_depth++;
+			if (m_depth == m_readingDepth)
+			{
+				resetInputs();
+			}
+			else if (m_depth == m_readingDepth + 1 &&
+				 m_key >= 0 && m_key < m_assetCount)
+			{
+				m_asset = m_key;
+				m_state.assetInputs[m_asset].found = true;
+				m_used = 0;
+			}
+			return Default();
+		};
+
+		bool	EndObject(rapidjson::SizeType memberCount)
+		{
+			if (m_depth == m_readingDepth + 1 && m_asset >= 0)
+			{
+				m_state.assetInputs[m_asset].datapoints = memberCount;
+				m_dropped += memberCount - m_used;
+				m_asset = -1;
+			}
+			else if (m_depth == m_readingDepth && m_results)
+			{
+				m_rule.batchReading(m_state, *m_results);
+			}
+			m_depth--;
+			return Default();
+		};
+
+		bool	StartArray()
+		{
+			m_depth++;
+			return Default();
+		};
+
+		bool	EndArray(rapidjson::SizeType)
+		{
+			m_depth--;
+			return Default();
+		};
+
+	private:
+		void	resetInputs()
+		{
+			for (int i = 0; i < m_assetCount; i++)
+			{
+				m_state.assetInputs[i].reset();
+			}
+		};
+
+		bool	Number(double value)
+		{
+			if (m_depth == m_readingDepth && m_key >= m_assetCount)
+			{
+				SimpleExpression::AssetInput& input =
+					m_state.assetInputs[m_key - m_assetCount];
+				input.hasTimestamp = true;
+				input.timestamp = value;
+			}
+			// A number is not bound to a variable compared with
+			// string literals: exprtk would not compile it
+			else if (m_depth == m_readingDepth + 1 &&
+				 m_asset >= 0 && m_slot >= 0 &&
+				 !m_state.evaluators[m_asset]->isStringSlot(m_slot))
+			{
+				m_state.evaluators[m_asset]->setVariable(m_slot, value);
+				m_used++;
+			}
+			return Default();
+		};
+
+	private:
+		SimpleExpression&	m_rule;
+		SimpleExpression::RuleState&
+					m_state;
+		std::vector<bool>	*m_results;
+		int			m_assetCount;
+		int			m_readingDepth;
+		int			m_depth;
+		int			m_key;
+		int			m_asset;
+		int			m_slot;
+		unsigned int		m_used;
+		unsigned long		m_dropped;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef _RULE_METRICS_H
+#define _RULE_METRICS_H
+/*
+ * FogLAMP SimpleExpression runtime metrics
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <atomic>
+#include <string>
+
+// Latency histogram buckets: bucket i counts the evaluations
+// taking [2^i, 2^(i+1)) nanoseconds, the last one the longer ones
+#define METRICS_LATENCY_BUCKETS	32
+
+/**
+ * Counters of a rule instance, scraped with plugin_metrics()
+ *
+ * The counters are updated with relaxed atomic operations: they are
+ * not ordered with respect to each other nor to the rule state, which
+ * is fine for statistics and keeps the evaluation path cheap.
+ */
+class RuleMetrics
+{
+	public:
+		enum Counter {
+			Evaluations,
+			ParseErrors,
+			Compiles,
+			CompileErrors,
+			InvalidResults,
+			DroppedDatapoints,
+			StateChanges,
+			ThrottledReadings,
+			// Heap allocations made by the parsing buffers
+			ParseAllocations,
+			CounterCount
+		};
+
+		RuleMetrics();
+
+		void	add(Counter counter, unsigned long count = 1)
+			{
+				m_counters[counter].fetch_add(count,
+							      std::memory_order_relaxed);
+			};
+		void	addLatency(unsigned long nanoseconds);
+		std::string
+			toJSON() const;
+
+	private:
+		std::atomic<unsigned long>	m_counters[CounterCount];
+		std::atomic<unsigned long>	m_latency[METRICS_LATENCY_BUCKETS];
+};
+
+#endif
@@ -10,14 +10,70 @@
  * Author: Amandeep Singh Arora, Massimiliano Pinto
  */
 #include <plugin.h>
+#include <logger.h>
 #include <config_category.h>
 #include <rule_plugin.h>
 #include <builtin_rule.h>
 #include <exprtk.hpp>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <string_index.h>
+#include <parse_context.h>
+#include <vector_kernel.h>
+#include <expression_cache.h>
+#include <rule_metrics.h>
+#include <trace_ring.h>
+#include <closure_program.h>
+#include <worker_pool.h>
 
 class Datapoint;
+class Reading;
 
-#define MAX_EXPRESSION_VARIABLES 20
+// Rows of a batch evaluated by one task of the worker pool
+#ifndef BATCH_CHUNK_ROWS
+#define BATCH_CHUNK_ROWS	1024
+#endif
+
+// Distinct string values an Evaluator gives a code to, beyond the
+// literals of its expressions
+#ifndef EVALUATOR_MAX_STRINGS
+#define EVALUATOR_MAX_STRINGS	65536
+#endif
+
+// Batch workers when the number of processors is unknown: more are
+// never configured than there are processors
+#ifndef BATCH_MAX_WORKERS
+#define BATCH_MAX_WORKERS	8
+#endif
+
+/**
+ * A datapoint value passed to plugin_eval_values(): the
+ * strings are null terminated and only read during the call
+ */
+struct SimpleExpressionValue {
+	const char	*asset;
+	const char	*name;
+	double		value;
+};
+
+/*
+ * Debug logging for the evaluation path: the message is only built
+ * when debug logging was enabled at the last rule (re)configure.
+ * Define SIMPLE_EXPRESSION_NO_HOTPATH_DEBUG to compile it out.
+ */
+#ifdef SIMPLE_EXPRESSION_NO_HOTPATH_DEBUG
+#define HOTPATH_DEBUG(rule, ...)
+#else
+#define HOTPATH_DEBUG(rule, ...) \
+	do { \
+		if ((rule)->isDebugEnabled()) \
+		{ \
+			Logger::getLogger()->debug(__VA_ARGS__); \
+		} \
+	} while (0)
+#endif
 
 /**
  * SimpleExpression class, derived from Notification BuiltinRule
@@ -25,60 +81,504 @@ class Datapoint;
 class SimpleExpression: public BuiltinRule
 {
 	public:
+		/**
+		 * One of the expressions of a rule: the result of a named
+		 * expression can be used by the expressions that follow it
+		 */
+		struct NamedExpression {
+			std::string	name;
+			std::string	expression;
+			// False for the expressions only computing
+			// values for the others
+			bool		trigger;
+		};
 		class Evaluator {
 			public:
 				Evaluator();
-				bool	parserCompile(const std::string& expression)
-				{
-					return m_parser.compile(expression.c_str(),
-								m_expression);
-				};
+				bool	configure(const std::vector<NamedExpression>& expressions,
+						  const std::string& clearExpression = "",
+						  bool singlePrecision = false);
 				std::string
 					getError()
 				{
-					return m_parser.error();
+					return m_error;
 				};
-				void registerSymbolTable()
+				bool	isCompiled() { return m_compiled; };
+				// True once every referenced variable got a value
+				bool	isBound() { return m_unboundCount == 0; };
+				unsigned long
+					getCompileCount() { return m_compileCount; };
+				// The shared template, once configured
+				const ExpressionTemplate&
+					getTemplate() const { return *m_template; };
+				// True if the template variables were
+				// restored from the BindingStore
+				bool	isRestored() const
 				{
-					m_expression.register_symbol_table(m_symbolTable);
+					return m_template && m_template->isRestored();
 				};
 
-				void	addVariable(const std::string& dapointName, double value);
+				void	addVariable(const char *dapointName,
+						size_t length,
+						double value);
+				// Slot of a referenced datapoint or -1
+				int	findVariable(const char *dapointName,
+						 size_t length)
+				{
+					return m_variableIndex.find(dapointName, length);
+				};
+				void	setVariable(int slot, double value)
+				{
+					if (m_singlePrecision)
+					{
+						value = (float) value;
+					}
+					// Bitwise comparison: a NaN is unchanged
+					// and -0.0 differs from 0.0
+					if (memcmp(&m_variables[slot], &value, sizeof(double)) != 0)
+					{
+						m_variables[slot] = value;
+						m_version++;
+					}
+					m_variableSeen[slot] = true;
+					if (!m_variableBound[slot])
+					{
+						m_variableBound[slot] = true;
+						m_unboundCount--;
+					}
+				};
+				// The value a string datapoint is bound to: the
+				// code of a literal, or from the literal count
+				// plus 1 the code this Evaluator gives each other
+				// value. Once EVALUATOR_MAX_STRINGS values have a
+				// code, the others are NaN, unequal to any value
+				double	internString(const char *value, size_t length)
+				{
+					double code = m_template->internString(value, length);
+					if (code != 0.0)
+					{
+						return code;
+					}
+					int position = m_strings.find(value, length);
+					if (position < 0)
+					{
+						if (m_strings.size() >= EVALUATOR_MAX_STRINGS)
+						{
+							return NAN;
+						}
+						position = m_strings.add(value, length);
+					}
+					return m_template->getLiteralCount() + 1 + position;
+				};
+				// True if the slot is compared with string
+				// literals: numbers are not bound to it
+				bool	isStringSlot(int slot) const
+				{
+					return m_stringSlots[slot] != 0;
+				};
+				// True if strings are bound to the slot: it is
+				// compared with string literals, or only with
+				// other variables
+				bool	takesStrings(int slot) const
+				{
+					return m_stringSlots[slot] != 0 ||
+					       m_stringPairSlots[slot] != 0;
+				};
 				int	getVarCount() { return m_varCount; };
-				double	evaluate() { return m_expression.value(); };
+				// Evaluate the rule expressions in order, see
+				// getResult(). Without a variable change since the
+				// previous evaluation the previous results are kept
+				// if the expressions are stateless
+				void	evaluate()
+				{
+					if (!m_stateless || m_resultVersion != m_version)
+					{
+						for (size_t i = 0; i < m_expressionCount; i++)
+						{
+							m_results[i] = this->value(i);
+						}
+						m_resultVersion = m_version;
+					}
+				};
+				size_t	getExpressionCount() { return m_expressionCount; };
+				double	getResult(size_t index) { return m_results[index]; };
+				bool	isTrigger(size_t index) { return m_triggers[index]; };
+				bool	hasClear() { return m_hasClear; };
+				double	evaluateClear()
+				{
+					// The clear expression may read named results
+					if (m_hasNames)
+					{
+						this->evaluate();
+					}
+					if (!m_stateless || m_clearResultVersion != m_version)
+					{
+						m_clearResult = this->value(m_expressionCount);
+						m_clearResultVersion = m_version;
+					}
+					return m_clearResult;
+				};
+				// The last triggering expression of the latest
+				// evaluation, or -1
+				int	getSeverity() { return m_severity; };
+				void	setSeverity(int severity) { m_severity = severity; };
+
+				// Windowed functions, updated once per reading
+				// of the asset before evaluate()
+				bool	hasWindows() { return !m_windowSources.empty(); };
+				void	updateWindows(double timestamp);
+
+				// Columnar evaluation of batches, if the expression
+				// is supported by the vector kernel
+				bool	hasKernel() { return m_kernel.isCompiled(); };
+				void	appendRow()
+				{
+					for (int i = 0; i < m_varCount; i++)
+					{
+						if (m_singlePrecision)
+						{
+							m_floatColumns[i].push_back(m_variables[i]);
+						}
+						else
+						{
+							m_columns[i].push_back(m_variables[i]);
+						}
+					}
+					m_rows++;
+				};
+				void	clearRows()
+				{
+					for (auto &column : m_columns)
+					{
+						column.clear();
+					}
+					for (auto &column : m_floatColumns)
+					{
+						column.clear();
+					}
+					m_rows = 0;
+				};
+				size_t	getRowCount() { return m_rows; };
+				// True if the rows of a batch can be evaluated
+				// in any order, by copies of this Evaluator
+				bool	isParallel()
+				{
+					return m_compiled &&
+					       (m_kernel.isCompiled() ||
+						(m_stateless &&
+						 !m_hasClear &&
+						 m_expressionCount == 1 &&
+						 m_triggers[0]));
+				};
+				size_t	evaluateRows(const Evaluator& source,
+						     size_t first,
+						     size_t count,
+						     unsigned char *results);
+
+			private:
+				bool	parserCompile(const std::string& expression,
+						      exprtk::expression<double>& compiled);
+				double	value(size_t index)
+				{
+#ifdef SIMPLE_EXPRESSION_CLOSURES
+					ClosureState& closure = m_closures[index];
+					if (closure.stage == ClosureNative)
+					{
+						return closure.program->evaluate();
+					}
+					double result = m_expressions[index].value();
+					if (closure.stage != ClosureUnsupported)
+					{
+						this->promote(index, result);
+					}
+					return result;
+#else
+					return m_expressions[index].value();
+#endif
+				};
+#ifdef SIMPLE_EXPRESSION_CLOSURES
+				/**
+				 * An expression is evaluated by exprtk, then
+				 * compiled to closures and verified against
+				 * exprtk, then evaluated by the closures
+				 */
+				enum ClosureStage {
+					ClosureInterpreted,
+					ClosureVerifying,
+					ClosureNative,
+					ClosureUnsupported
+				};
+				struct ClosureState {
+					ClosureState() : stage(ClosureInterpreted),
+							 count(0)
+					{
+					};
+					ClosureStage	stage;
+					unsigned long	count;
+					std::shared_ptr<ClosureProgram>
+							program;
+				};
+				void	promote(size_t index, double result);
+#endif
 
 			private:
-				exprtk::expression<double>	m_expression;
+				// The rule expressions followed by the clear
+				// expression, if any
+				std::vector<exprtk::expression<double> >
+								m_expressions;
+				size_t				m_expressionCount;
+				// The rule expression results: the variables
+				// of the named expressions
+				std::vector<double>		m_results;
+				std::vector<bool>		m_triggers;
+				bool				m_hasNames;
+				int				m_severity;
+#ifdef SIMPLE_EXPRESSION_CLOSURES
+				std::vector<ClosureState>	m_closures;
+#endif
 				exprtk::symbol_table<double>	m_symbolTable;
-				exprtk::parser<double>		m_parser;
-				double				m_variables[MAX_EXPRESSION_VARIABLES];
-				std::string			m_variableNames[MAX_EXPRESSION_VARIABLES];
+				std::shared_ptr<const ExpressionTemplate>
+								m_template;
+				std::string			m_error;
+				// Sized once by configure(): exprtk holds references
+				// to the elements, so these are never resized after
+				std::vector<double>		m_variables;
+				std::vector<std::string>	m_variableNames;
+				std::vector<unsigned char>	m_variableBound;
+				// Variables set since the last updateWindows()
+				std::vector<unsigned char>	m_variableSeen;
 				int				m_varCount;
+				int				m_unboundCount;
+				StringIndex			m_variableIndex;
+				// String values without a literal code, the
+				// slots taking string values only and those
+				// taking strings or numbers
+				StringIndex			m_strings;
+				std::vector<unsigned char>	m_stringSlots;
+				std::vector<unsigned char>	m_stringPairSlots;
+				bool				m_compiled;
+				bool				m_hasClear;
+				// Variable changes count and the count at
+				// the time the results were computed
+				bool				m_stateless;
+				unsigned long			m_version;
+				unsigned long			m_resultVersion;
+				unsigned long			m_clearResultVersion;
+				double				m_clearResult;
+				unsigned long			m_compileCount;
+				// Variables, window samples and batch columns
+				// hold float values, exprtk still computes
+				// in double precision
+				bool				m_singlePrecision;
+				// Only one of the window vectors is used
+				std::vector<WindowFunction<double> >
+								m_windows;
+				std::vector<WindowFunction<float> >
+								m_floatWindows;
+				std::vector<int>		m_windowSources;
+				std::vector<double>		m_windowValues;
+				VectorKernel			m_kernel;
+				std::vector<std::vector<double> >
+								m_columns;
+				std::vector<std::vector<float> >
+								m_floatColumns;
+				size_t				m_rows;
+		};
+		/**
+		 * What a plugin_eval() call received for a configured asset
+		 */
+		struct AssetInput {
+			void	reset()
+			{
+				found = false;
+				datapoints = 0;
+				hasTimestamp = false;
+			};
+			bool		found;
+			unsigned int	datapoints;
+			bool		hasTimestamp;
+			double		timestamp;
+		};
+		/**
+		 * A reading of a batch waiting for columnar evaluation
+		 */
+		struct BatchRow {
+			AssetInput	input;
+			bool		bound;
+		};
+		/**
+		 * The compiled rule configuration
+		 *
+		 * configure() builds a new RuleState and publishes it with
+		 * an atomic pointer swap: evaluations take a reference to
+		 * the current state once per call and keep using it, so a
+		 * reconfigure never waits for, nor invalidates, an in flight
+		 * evaluation and the old state is freed when the last
+		 * evaluation using it returns.
+		 *
+		 * The state is not changed after it is published apart from
+		 * the evaluation scratch data (variable values, asset inputs
+		 * and batch rows): as for the notification service, a rule
+		 * is evaluated by one thread at a time.
+		 */
+		struct RuleState {
+			RuleState() : named(false),
+				      matchAll(true),
+				      holdReadings(1),
+				      holdTime(0.0),
+				      traceSampling(0),
+				      singlePrecision(false),
+				      workers(1),
+				      evaluateInterval(0.0),
+				      evaluateEvery(1),
+				      generation(0),
+				      columnarBatch(false),
+				      batchRowCount(0)
+			{
+			};
+			std::string	expression;
+			std::vector<NamedExpression>
+					expressions;
+			// True if the expression item was a list
+			bool		named;
+			// Once triggered, clear when true if not empty
+			std::string	clearExpression;
+			// Configured assets, each with its own Evaluator.
+			// Positions [0, count) of the asset index are the
+			// asset names, [count, 2 * count) their timestamp keys
+			std::vector<std::string>
+					assetNames;
+			std::vector<std::shared_ptr<Evaluator> >
+					evaluators;
+			StringIndex	assetIndex;
+			std::vector<AssetInput>
+					assetInputs;
+			// True if all assets must trigger, false if any can
+			bool		matchAll;
+			// How long a new result must hold before the
+			// state changes
+			unsigned long	holdReadings;
+			double		holdTime;
+			// Trace one plugin_eval() call in traceSampling,
+			// none if 0
+			unsigned long	traceSampling;
+			// Datapoint values stored as floats
+			bool		singlePrecision;
+			// Workers evaluating the batch rows, each with
+			// its own Evaluator of each asset: the Evaluator
+			// of the asset a of worker w is at w * assets + a.
+			// No pool if the batch is not evaluated in parallel
+			unsigned long	workers;
+			std::shared_ptr<WorkerPool>
+					pool;
+			std::vector<std::shared_ptr<Evaluator> >
+					workerEvaluators;
+			// Evaluate at most once in evaluateInterval seconds
+			// and one reading in evaluateEvery, the readings
+			// in between only update the windowed functions
+			double		evaluateInterval;
+			unsigned long	evaluateEvery;
+			// Changed with the expressions, see m_generation
+			unsigned long	generation;
+			// Batch evaluation scratch data
+			bool		columnarBatch;
+			size_t		batchRowCount;
+			std::vector<BatchRow>
+					batchRows;
+			std::vector<unsigned char>
+					batchResults;
 		};
 	public:
 		SimpleExpression();
 		~SimpleExpression();
 
 		bool	configure(const ConfigCategory& config);
-		bool	evalAsset(const Value& assetValue);
+		bool	evalVariables(RuleState& state,
+				      size_t asset,
+				      bool clear = false);
+		bool	evalReading(RuleState& state,
+				    TraceSample *sample = NULL);
+		void	startBatch(RuleState& state);
+		void	batchReading(RuleState& state,
+				     std::vector<bool>& results);
+		void	finishBatch(RuleState& state,
+				    std::vector<bool>& results);
 		void	lockConfig() { m_configMutex.lock(); };
 		void	unlockConfig() { m_configMutex.unlock(); };
 
-		void	setTrigger(const std::string& expression)
-			{
-				m_expression = expression;
-			};
+		// The current compiled configuration
+		std::shared_ptr<RuleState>
+			getState() { return std::atomic_load(&m_state); };
+
+		ParseContext&
+			getParseContext() { return m_parseContext; };
+
+		// plugin_triggers() document, built by configure()
 		const std::string&
-			getTrigger() { return m_expression; };
+			getTriggersJSON() { return m_triggersJSON; };
+		// Reused by plugin_reason()
+		std::string&
+			getReasonBuffer() { return m_reason; };
 
-		Evaluator*
-			getEvaluator() { return m_triggerExpression; };
+		std::string
+			getSeverity();
+		RuleMetrics&
+			getMetrics() { return m_metrics; };
+		bool	sampleTrace(RuleState& state, TraceSample& sample);
+		void	endTrace(TraceSample& sample,
+				 uint64_t end,
+				 bool result);
+		const TraceRing&
+			getTraceRing() { return m_traceRing; };
+
+		void	refreshLogLevel();
+		bool	isDebugEnabled() { return m_debugEnabled; };
+
+	private:
+		bool	parseExpressions(const std::string& item,
+					 RuleState& state);
+		void	checkResult(double evaluation);
+		void	buildTriggersJSON();
+		std::shared_ptr<Evaluator>
+			createEvaluator(const RuleState& state);
+		void	configureWorkers(RuleState& state);
+		bool	evalRow(RuleState& state,
+				long row,
+				TraceSample *sample = NULL);
+		double	readingTime(RuleState& state, long row);
+		void	checkGeneration(const RuleState& state);
+		bool	throttle(RuleState& state, long row);
+		void	updateWindows(RuleState& state, long row);
+		bool	evalAssets(RuleState& state, long row, bool clear);
+		bool	evalAsset(RuleState& state,
+				  size_t asset,
+				  long row,
+				  bool clear);
 
 	private:
 		std::mutex	m_configMutex;
-		std::string	m_expression;
 		bool		m_pendingReconfigure;
-		Evaluator	*m_triggerExpression;
+		std::shared_ptr<RuleState>
+				m_state;
+		ParseContext	m_parseContext;
+		bool		m_debugEnabled;
+		// The notification state set by the last evaluation
+		bool		m_triggered;
+		// The hold and throttling progress, only used by the
+		// evaluating thread as m_triggered: it starts again when
+		// the generation of the state in use is not m_generation
+		unsigned long	m_generation;
+		bool		m_holdPending;
+		unsigned long	m_holdCount;
+		double		m_holdSince;
+		unsigned long	m_throttleCount;
+		bool		m_throttleStarted;
+		double		m_lastEvaluation;
+		std::string	m_triggersJSON;
+		std::string	m_reason;
+		RuleMetrics	m_metrics;
+		unsigned long	m_traceCount;
+		TraceRing	m_traceRing;
 };
 
 #endif
@@ -0,0 +1,58 @@
+#ifndef _STRING_INDEX_H
+#define _STRING_INDEX_H
+/*
+ * FogLAMP SimpleExpression string index
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Open addressing hash table mapping a set of names to their
+ * position in the set
+ *
+ * The table is built when the set of names is known, or grows with
+ * add(), and lookups work on a character pointer and a length so that
+ * names coming from the JSON parser do not need a std::string.
+ */
+class StringIndex
+{
+	public:
+		StringIndex(bool caseSensitive = true);
+
+		void	build(const std::vector<std::string>& keys);
+		int	add(const char *key, size_t length);
+		int	find(const char *key, size_t length) const;
+		int	find(const std::string& key) const
+			{
+				return find(key.c_str(), key.length());
+			};
+		size_t	size() const { return m_keys.size(); };
+
+	private:
+		uint32_t
+			hash(const char *key, size_t length) const;
+		bool	equal(const std::string& key,
+			      const char *other,
+			      size_t length) const;
+		void	rehash(size_t capacity);
+
+	private:
+		struct Entry {
+			uint32_t	hash;
+			int		position;
+		};
+		bool			m_caseSensitive;
+		std::vector<std::string>
+					m_keys;
+		std::vector<Entry>	m_table;
+		uint32_t		m_mask;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _TRACE_RING_H
+#define _TRACE_RING_H
+/*
+ * FogLAMP SimpleExpression evaluation tracing
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+
+// Number of traced evaluations kept
+#define TRACE_RING_SIZE		256
+
+/**
+ * Stage timings of a traced plugin_eval() call
+ *
+ * While the call runs the fields hold steady clock time points,
+ * traceClock() values, when it completes the stage durations
+ * in nanoseconds.
+ */
+struct TraceSample {
+	uint64_t	evaluation;
+	uint64_t	start;
+	// JSON scan, asset lookup and variable binding: one SAX pass
+	uint64_t	parse;
+	// Expression evaluation of the configured assets
+	uint64_t	evaluate;
+	// Hold options and rule state update
+	uint64_t	state;
+	bool		result;
+};
+
+/**
+ * Return the steady clock time in nanoseconds
+ */
+inline uint64_t traceClock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>
+		(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Fixed size ring of the latest traced evaluations
+ *
+ * The ring has a single writer, the thread evaluating the rule, and
+ * any number of readers: each slot is protected by a sequence number,
+ * odd while the slot is written, so neither side takes a lock and a
+ * reader skips the slots changed while it read them.
+ */
+class TraceRing
+{
+	public:
+		TraceRing();
+
+		void	push(const TraceSample& sample);
+		std::string
+			toJSON() const;
+
+	private:
+		struct Slot {
+			std::atomic<unsigned long>	sequence;
+			std::atomic<uint64_t>		evaluation;
+			std::atomic<uint64_t>		parse;
+			std::atomic<uint64_t>		evaluate;
+			std::atomic<uint64_t>		state;
+			std::atomic<bool>		result;
+		};
+
+	private:
+		Slot				m_slots[TRACE_RING_SIZE];
+		std::atomic<unsigned long>	m_head;
+};
+
+#endif
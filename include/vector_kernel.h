@@ -0,0 +1,89 @@
+#ifndef _VECTOR_KERNEL_H
+#define _VECTOR_KERNEL_H
+/*
+ * FogLAMP SimpleExpression vectorised evaluation kernel
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <string_index.h>
+
+/**
+ * Columnar evaluation of comparison expressions
+ *
+ * Expressions made only of comparisons between variables and numeric
+ * constants, combined with "and", "or" and "not()", for example
+ * "humidity > 50 and temperature < 30", are compiled into a small
+ * postfix program. The program evaluates a whole batch of readings
+ * laid out column-wise, one contiguous array of values per variable,
+ * with SIMD comparisons (AVX, SSE2 or NEON, as available at build
+ * time) and byte mask logical operations. Columns of floats are
+ * evaluated with twice as many values per SIMD register.
+ *
+ * Expressions outside that subset are not compiled and are left to
+ * the exprtk evaluator.
+ */
+class VectorKernel
+{
+	public:
+		enum Opcode {
+			OpCompare,
+			OpAnd,
+			OpOr,
+			OpNot
+		};
+		enum Comparison {
+			CmpLess,
+			CmpLessEqual,
+			CmpGreater,
+			CmpGreaterEqual,
+			CmpEqual,
+			CmpNotEqual
+		};
+		/**
+		 * A program instruction: comparisons read the variable
+		 * slot lhs against the slot rhs or, if rhs is -1,
+		 * against the constant
+		 */
+		struct Instruction {
+			Opcode		op;
+			Comparison	comparison;
+			int		lhs;
+			int		rhs;
+			double		constant;
+		};
+
+		VectorKernel();
+
+		bool	compile(const std::string& expression,
+				const StringIndex& variables);
+		bool	isCompiled() const { return !m_program.empty(); };
+		void	evaluate(const std::vector<std::vector<double> >& columns,
+				 size_t first,
+				 size_t rows,
+				 unsigned char *results);
+		void	evaluate(const std::vector<std::vector<float> >& columns,
+				 size_t first,
+				 size_t rows,
+				 unsigned char *results);
+
+	private:
+		template <class T>
+		void	run(const std::vector<std::vector<T> >& columns,
+			    size_t first,
+			    size_t rows,
+			    unsigned char *results);
+
+	private:
+		std::vector<Instruction>	m_program;
+		size_t				m_depth;
+		std::vector<std::vector<unsigned char> >
+						m_stack;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef _WINDOW_FUNCTION_H
+#define _WINDOW_FUNCTION_H
+/*
+ * FogLAMP SimpleExpression windowed functions
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Upper bound of the samples a time window keeps
+#define WINDOW_MAX_SAMPLES	16384
+
+/**
+ * FIFO of bounded capacity, with removal at both ends
+ *
+ * The storage grows on demand up to the capacity, then it is reused.
+ */
+template<class T> class RingBuffer
+{
+	public:
+		RingBuffer(size_t capacity) : m_capacity(capacity),
+					      m_head(0),
+					      m_count(0)
+		{
+		};
+
+		bool	empty() const { return m_count == 0; };
+		bool	full() const { return m_count == m_capacity; };
+		size_t	size() const { return m_count; };
+		T&	front() { return m_data[m_head]; };
+		const T&
+			front() const { return m_data[m_head]; };
+		// The item at position index from the front
+		T&	operator[](size_t index)
+			{
+				return m_data[(m_head + index) % m_data.size()];
+			};
+		T&	back() { return m_data[(m_head + m_count - 1) % m_data.size()]; };
+		void	pop_front()
+			{
+				m_head = (m_head + 1) % m_data.size();
+				m_count--;
+			};
+		void	pop_back() { m_count--; };
+		void	push_back(const T& item)
+			{
+				if (m_count == m_data.size())
+				{
+					grow();
+				}
+				m_data[(m_head + m_count) % m_data.size()] = item;
+				m_count++;
+			};
+
+	private:
+		void	grow()
+			{
+				size_t size = m_data.empty() ? 16 : m_data.size() * 2;
+				if (size > m_capacity)
+				{
+					size = m_capacity;
+				}
+				std::vector<T> data(size);
+				for (size_t i = 0; i < m_count; i++)
+				{
+					data[i] = m_data[(m_head + i) % m_data.size()];
+				}
+				m_data.swap(data);
+				m_head = 0;
+			};
+
+	private:
+		size_t		m_capacity;
+		size_t		m_head;
+		size_t		m_count;
+		std::vector<T>	m_data;
+};
+
+/**
+ * The windowed functions an expression can call
+ */
+class WindowFunctionBase
+{
+	public:
+		enum Type {
+			WindowAvg,
+			WindowMin,
+			WindowMax,
+			WindowStdDev,
+			Rate,
+			Delta
+		};
+
+		static bool
+			parseType(const std::string& name,
+				  Type& type,
+				  bool& hasDuration);
+};
+
+/**
+ * A stateful function of a datapoint over the readings received
+ *
+ * Each update adds a sample and returns the function value, in O(1)
+ * amortised time: the sum and the sum of squares of the samples in
+ * the window are kept up to date, the minimum and maximum come from
+ * a monotonic queue. Samples older than the window duration, or
+ * beyond WINDOW_MAX_SAMPLES, are dropped.
+ *
+ * The sums are of the differences to a reference sample, so that
+ * the variance of values with a large offset keeps its precision.
+ * They are recomputed from the window once as many samples as it
+ * holds have been dropped, and when a sample that made them overflow
+ * is dropped, so that neither rounding errors nor an infinite sum
+ * outlive the samples. NaN and infinite values are not
+ * added to the window.
+ *
+ * The sample values are stored as T, double or float: a float
+ * sample takes 16 bytes instead of 24. Sums are always accumulated
+ * in double precision.
+ */
+template<class T> class WindowFunction : public WindowFunctionBase
+{
+	public:
+		WindowFunction(Type type,
+			       double seconds,
+			       size_t maxSamples = WINDOW_MAX_SAMPLES);
+
+		double	update(double timestamp, double value);
+
+	private:
+		struct Sample {
+			double		timestamp;
+			T		value;
+			// Wraps around, compared by difference
+			uint32_t	sequence;
+		};
+		void	dropOldest();
+		void	recompute();
+		bool	accumulate(double value, double sign);
+		double	value() const;
+
+	private:
+		Type			m_type;
+		double			m_seconds;
+		RingBuffer<Sample>	m_samples;
+		// Monotonic queue for the window minimum or maximum
+		RingBuffer<Sample>	m_extremes;
+		// Sums of the differences to m_reference
+		double			m_reference;
+		double			m_sum;
+		double			m_sumSquares;
+		// Samples dropped since the sums were recomputed
+		size_t			m_dropped;
+		uint32_t		m_sequence;
+		bool			m_hasPrevious;
+		double			m_previousTimestamp;
+		double			m_previousValue;
+};
+
+#endif
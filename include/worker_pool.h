@@ -0,0 +1,60 @@
+#ifndef _WORKER_POOL_H
+#define _WORKER_POOL_H
+/*
+ * FogLAMP SimpleExpression batch worker pool
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of threads running the tasks of one job at a time
+ *
+ * run() hands out the task numbers of a job through an atomic
+ * counter: each worker takes the next task as soon as it is done
+ * with the previous one, so fast workers take over the tasks slow
+ * ones have not started. The calling thread is one of the workers,
+ * the pool holds the others.
+ */
+class WorkerPool
+{
+	public:
+		typedef std::function<void (size_t task, size_t worker)>
+				Work;
+
+		WorkerPool(size_t workers);
+		~WorkerPool();
+
+		// Workers running a job, the calling thread included
+		size_t	getWorkerCount() const { return m_threads.size() + 1; };
+		void	run(size_t tasks, const Work& work);
+
+	private:
+		void	worker(size_t worker);
+		void	runTasks(size_t worker);
+
+	private:
+		std::vector<std::thread>	m_threads;
+		std::mutex			m_mutex;
+		std::condition_variable		m_start;
+		std::condition_variable		m_done;
+		// The current job, changed by run() under the mutex
+		const Work			*m_work;
+		size_t				m_tasks;
+		unsigned long			m_generation;
+		bool				m_shutdown;
+		std::atomic<size_t>		m_next;
+		// Pool threads still running tasks of the job
+		size_t				m_running;
+};
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * FogLAMP SimpleExpression parse context
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <parse_context.h>
+#include <string.h>
+
+using namespace std;
+
+/**
+ * Constructor: the reader stack uses the counting allocator
+ */
+ParseContext::ParseContext() : m_reader(&m_allocator),
+			       m_bufferAllocations(0)
+{
+}
+
+/**
+ * Copy the data to parse into the reused buffer
+ *
+ * @param    data	The JSON data
+ * @return		The null terminated buffer to parse in situ
+ */
+char *ParseContext::load(const string& data)
+{
+	size_t size = data.length() + 1;
+	if (m_buffer.size() < size)
+	{
+		size_t capacity = m_buffer.empty() ? 1024 : m_buffer.size();
+		while (capacity < size)
+		{
+			capacity <<= 1;
+		}
+		m_buffer.resize(capacity);
+		m_bufferAllocations++;
+	}
+	memcpy(&m_buffer[0], data.c_str(), size);
+
+	return &m_buffer[0];
+}
@@ -12,11 +12,19 @@
 #include <logger.h>
 #include <plugin_exception.h>
 #include <iosfwd>
+#include <algorithm>
+#include <strings.h>
+#include <syslog.h>
+#include <sys/time.h>
 #include <config_category.h>
 #include <rapidjson/writer.h>
 #include <builtin_rule.h>
+#include <reading.h>
 #include "version.h"
 #include "simple_expression.h"
+#include "reading_handler.h"
+#include "numeric_value.h"
+#include "binding_store.h"
 
 #define RULE_NAME "SimpleExpression"
 #define RULE_DESCRIPTION  "Generate a notification based on the evaluation of a user provided expression"
@@ -42,7 +50,8 @@
  * And if the value of boolean expression toggles, then the notification is sent.
  *
  * NOTE:
- * Datapoint names and values are dynamically added when "plugin_eval" is called
+ * Datapoint names are resolved from the expression at configure time,
+ * their values are updated when "plugin_eval" is called
  */
 
 
@@ -62,24 +71,208 @@ const char * defaultConfiguration = QUOTE(
 		"readonly" : "true"
 	},
 	"asset" : {
-		"description" : "The asset name for which notifications will be generated.",
+		"description" : "The asset name for which notifications will be generated. A comma separated list of asset names can be given.",
 		"type" : "string",
 		"default" : "",
 		"displayName" : "Asset name",
 		"order" : "1"
 	},
 	"expression" : {
-		"description" : "Expression to apply.",
+		"description" : "Expression to apply, or a JSON array of named expressions evaluated in order.",
 		"name" : "Expression",
 		"type" : "string",
 		"default": "",
 		"displayName" : "Expression to apply",
 		"order" : "2"
+	},
+	"combine" : {
+		"description" : "With more than one asset, trigger if the expression is true for all the assets or for any of them.",
+		"type" : "enumeration",
+		"options" : [ "All", "Any" ],
+		"default" : "All",
+		"displayName" : "Combine assets",
+		"order" : "3"
+	},
+	"clearExpression" : {
+		"description" : "Once triggered, clear the notification when this expression is true rather than when the trigger expression is false. Leave empty to clear when the trigger expression is false.",
+		"type" : "string",
+		"default": "",
+		"displayName" : "Clear expression",
+		"order" : "4"
+	},
+	"holdReadings" : {
+		"description" : "The number of consecutive readings a new evaluation result must hold for before the notification state changes.",
+		"type" : "integer",
+		"default": "1",
+		"displayName" : "Readings to hold",
+		"order" : "5"
+	},
+	"holdTime" : {
+		"description" : "The number of seconds a new evaluation result must hold for before the notification state changes.",
+		"type" : "float",
+		"default": "0",
+		"displayName" : "Seconds to hold",
+		"order" : "6"
+	},
+	"traceSampling" : {
+		"description" : "Trace the stage timings of one evaluation every this number of evaluations, 0 to disable tracing.",
+		"type" : "integer",
+		"default": "0",
+		"displayName" : "Trace sampling",
+		"order" : "7"
+	},
+	"precision" : {
+		"description" : "Store the datapoint values, the windowed function samples and the batch columns as double or as single precision floats, which take half the memory. Expressions are computed in double precision.",
+		"type" : "enumeration",
+		"options" : [ "double", "float" ],
+		"default" : "double",
+		"displayName" : "Value precision",
+		"order" : "8"
+	},
+	"workers" : {
+		"description" : "The number of threads evaluating the readings of a batch, 1 to evaluate them on the calling thread only, at most the number of processors.",
+		"type" : "integer",
+		"default": "1",
+		"displayName" : "Batch workers",
+		"order" : "9"
+	},
+	"evaluateInterval" : {
+		"description" : "Evaluate the expression at most once in this number of milliseconds of reading time, 0 to evaluate every reading. The readings in between only update the windowed functions.",
+		"type" : "integer",
+		"default": "0",
+		"displayName" : "Evaluation interval (ms)",
+		"order" : "10"
+	},
+	"evaluateEvery" : {
+		"description" : "Evaluate the expression for one reading in this number of readings. The readings in between only update the windowed functions.",
+		"type" : "integer",
+		"default": "1",
+		"displayName" : "Evaluate every Nth reading",
+		"order" : "11"
 	}
 });
 
 using namespace std;
 
+/**
+ * Parse notification data with the rule reading handler
+ *
+ * Parsing is in situ, on a buffer reused across calls.
+ *
+ * @param    rule	The rule
+ * @param    data	The JSON notification data
+ * @param    handler	The SAX handler binding the values
+ * @return		False on parse errors
+ */
+static bool parseData(SimpleExpression *rule,
+		      const string& data,
+		      ReadingHandler& handler)
+{
+	ParseContext& context = rule->getParseContext();
+	uint64_t allocations = context.getAllocations();
+
+	InsituStringStream stream(context.load(data));
+	context.getReader().Parse<kParseInsituFlag>(stream, handler);
+
+	RuleMetrics& metrics = rule->getMetrics();
+	if (context.getAllocations() != allocations)
+	{
+		HOTPATH_DEBUG(rule, "Parsing buffers grown, %lu allocations so far",
+			      (unsigned long)context.getAllocations());
+		metrics.add(RuleMetrics::ParseAllocations,
+			    context.getAllocations() - allocations);
+	}
+	if (handler.getDropped())
+	{
+		metrics.add(RuleMetrics::DroppedDatapoints, handler.getDropped());
+	}
+	if (context.getReader().HasParseError())
+	{
+		metrics.add(RuleMetrics::ParseErrors);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Mark the configured assets as not received, before binding
+ * the values of a new reading
+ *
+ * @param    state	The rule configuration in use
+ */
+static void resetInputs(SimpleExpression::RuleState& state)
+{
+	for (auto &input : state.assetInputs)
+	{
+		input.reset();
+	}
+}
+
+/**
+ * Bind the numeric and string datapoints of a reading, if its
+ * asset is configured
+ *
+ * @param    state	The rule configuration in use
+ * @param    reading	The reading
+ * @return		The number of datapoints of a configured
+ *			asset not used
+ */
+static unsigned long bindReading(SimpleExpression::RuleState& state,
+				 Reading& reading)
+{
+	const string& assetName = reading.getAssetName();
+	int asset = state.assetIndex.find(assetName);
+	if (asset < 0 || asset >= (int)state.assetNames.size())
+	{
+		return 0;
+	}
+
+	SimpleExpression::AssetInput& input = state.assetInputs[asset];
+	SimpleExpression::Evaluator& evaluator = *state.evaluators[asset];
+	struct timeval timestamp;
+	reading.getUserTimestamp(&timestamp);
+	input.found = true;
+	input.hasTimestamp = true;
+	input.timestamp = timestamp.tv_sec + timestamp.tv_usec / 1000000.0;
+
+	unsigned long dropped = 0;
+	const vector<Datapoint *>& datapoints = reading.getReadingData();
+	for (auto dp : datapoints)
+	{
+		DatapointValue& value = dp->getData();
+		double number;
+		bool numeric = toNumber(value, number);
+		if (!numeric && value.getType() != DatapointValue::T_STRING)
+		{
+			dropped++;
+			continue;
+		}
+
+		const string name = dp->getName();
+		int slot = evaluator.findVariable(name.c_str(), name.length());
+		if (slot < 0 ||
+		    (numeric && evaluator.isStringSlot(slot)) ||
+		    (!numeric && !evaluator.takesStrings(slot)))
+		{
+			dropped++;
+			continue;
+		}
+		if (numeric)
+		{
+			evaluator.setVariable(slot, number);
+		}
+		else
+		{
+			string text = value.toStringValue();
+			evaluator.setVariable(slot, evaluator.internString(text.c_str(),
+									  text.length()));
+		}
+	}
+	input.datapoints += datapoints.size();
+
+	return dropped;
+}
+
 /**
  * The C plugin interface
  */
@@ -142,39 +335,14 @@ void plugin_shutdown(PLUGIN_HANDLE handle)
  */
 string plugin_triggers(PLUGIN_HANDLE handle)
 {
-	string ret;
 	SimpleExpression* rule = (SimpleExpression *)handle;
 
-	// Configuration fetch is protected by a lock
+	// The document is built by configure(), under the same lock
 	rule->lockConfig();
-
-	if (!rule->hasTriggers())
-	{
-		ret = "{\"triggers\" : []}";
-		rule->unlockConfig();
-		return ret;
-	}
-
-	ret = "{\"triggers\" : [ ";
-	std::map<std::string, RuleTrigger *> triggers = rule->getTriggers();
-	for (auto it = triggers.begin();
-		  it != triggers.end();
-		  ++it)
-	{
-		ret += "{ \"asset\"  : \"" + (*it).first + "\"";
-		ret += " }";		
-		if (std::next(it, 1) != triggers.end())
-		{
-			ret += ", ";
-		}
-	}
-
-	ret += " ] }";
-
-	// Release lock
+	string ret = rule->getTriggersJSON();
 	rule->unlockConfig();
 
-	Logger::getLogger()->debug("plugin_triggers(): ret=%s", ret.c_str());
+	HOTPATH_DEBUG(rule, "plugin_triggers(): ret=%s", ret.c_str());
 
 	return ret;
 }
@@ -182,7 +350,9 @@ string plugin_triggers(PLUGIN_HANDLE handle)
 /**
  * Evaluate notification data received
  *
- *  Note: all assets must trigger in order to return TRUE
+ *  Note: the expression is evaluated for each configured asset,
+ *  with the "All" combination all assets must trigger in order
+ *  to return TRUE, with "Any" one asset triggering is enough
  *
  * @param    assetValues	JSON string document
  *				with notification data.
@@ -192,54 +362,204 @@ string plugin_triggers(PLUGIN_HANDLE handle)
 bool plugin_eval(PLUGIN_HANDLE handle,
 		 const string& assetValues)
 {
-	Logger::getLogger()->debug("plugin_eval(): assetValues=%s", assetValues.c_str());
-	Document doc;
-	doc.Parse(assetValues.c_str());
-	if (doc.HasParseError())
+	SimpleExpression* rule = (SimpleExpression *)handle;
+	uint64_t start = traceClock();
+
+	HOTPATH_DEBUG(rule, "plugin_eval(): assetValues=%s", assetValues.c_str());
+
+	// Evaluate with the current configuration: a reconfigure
+	// publishes a new state but this one remains valid until
+	// the evaluation returns
+	shared_ptr<SimpleExpression::RuleState> state = rule->getState();
+
+	// Single pass over the data: no document is built, the values
+	// of the configured assets go straight into the evaluator
+	// One call in traceSampling gets the timings of its stages
+	TraceSample sample;
+	TraceSample *traced = rule->sampleTrace(*state, sample) ? &sample : NULL;
+	if (traced)
 	{
-		return false;
+		sample.start = start;
 	}
 
+	ReadingHandler handler(*rule, *state);
 	bool eval = false;
+	bool parsed = parseData(rule, assetValues, handler);
+	if (traced)
+	{
+		sample.parse = sample.evaluate = traceClock();
+	}
+	if (parsed)
+	{
+		eval = rule->evalReading(*state, traced);
+	}
+
+	uint64_t end = traceClock();
+	rule->getMetrics().addLatency(end - start);
+	if (traced)
+	{
+		rule->endTrace(sample, end, eval);
+	}
+
+	return eval;
+}
+
+/**
+ * Evaluate notification data passed as FogLAMP readings
+ *
+ * This is plugin_eval() without the JSON round trip: the values of
+ * the numeric datapoints are bound straight to the expression
+ * variables. The reading user timestamp is the asset timestamp.
+ *
+ * @param    readings		The readings of the notification data,
+ *				readings of assets not configured are
+ *				ignored
+ * @return			True if the rule was triggered,
+ *				false otherwise.
+ */
+bool plugin_eval_readings(PLUGIN_HANDLE handle,
+			  const vector<Reading *>& readings)
+{
 	SimpleExpression* rule = (SimpleExpression *)handle;
+	uint64_t start = traceClock();
 
-	map<std::string, RuleTrigger *>& triggers = rule->getTriggers();
+	shared_ptr<SimpleExpression::RuleState> state = rule->getState();
 
-	// Iterate throgh all configured assets
-	// If we have multiple asset the evaluation result is
-	// TRUE only if all assets checks returned true
-	for (auto & t : triggers)
+	resetInputs(*state);
+	unsigned long dropped = 0;
+	for (auto reading : readings)
 	{
-		string assetName = t.first;
-		string assetTimestamp = "timestamp_" + assetName;
-		if (!doc.HasMember(assetName.c_str()))
-		{
-			eval = false;
-		}
-		else
-		{
-			// Get all datapoints for assetName
-			const Value& assetValue = doc[assetName.c_str()];
+		dropped += bindReading(*state, *reading);
+	}
+	if (dropped)
+	{
+		rule->getMetrics().add(RuleMetrics::DroppedDatapoints, dropped);
+	}
+
+	bool eval = rule->evalReading(*state);
+
+	rule->getMetrics().addLatency(traceClock() - start);
+
+	return eval;
+}
+
+/**
+ * Evaluate notification data passed as a flat array of values
+ *
+ * As plugin_eval_readings(), for callers that do not have FogLAMP
+ * readings at hand. Consecutive values of the same asset string
+ * look the asset up once.
+ *
+ * @param    values		The datapoint values
+ * @param    count		The number of values
+ * @param    timestamp		The timestamp of the assets in seconds,
+ *				if greater than zero
+ * @return			True if the rule was triggered,
+ *				false otherwise.
+ */
+bool plugin_eval_values(PLUGIN_HANDLE handle,
+			const SimpleExpressionValue *values,
+			size_t count,
+			double timestamp)
+{
+	SimpleExpression* rule = (SimpleExpression *)handle;
+	uint64_t start = traceClock();
 
-			// Set evaluation
-			eval = rule->evalAsset(assetValue);
+	shared_ptr<SimpleExpression::RuleState> state = rule->getState();
+	int assetCount = state->assetNames.size();
 
-			// Add evalution timestamp
-			if (doc.HasMember(assetTimestamp.c_str()))
+	resetInputs(*state);
+	unsigned long dropped = 0;
+	const char *assetName = NULL;
+	int asset = -1;
+	for (size_t i = 0; i < count; i++)
+	{
+		const SimpleExpressionValue& v = values[i];
+		if (v.asset != assetName)
+		{
+			assetName = v.asset;
+			asset = state->assetIndex.find(assetName, strlen(assetName));
+			if (asset >= assetCount)
 			{
-				const Value& assetTime = doc[assetTimestamp.c_str()];
-				double timestamp = assetTime.GetDouble();
-				rule->setEvalTimestamp(timestamp);
+				asset = -1;
 			}
+			if (asset >= 0)
+			{
+				SimpleExpression::AssetInput& input = state->assetInputs[asset];
+				input.found = true;
+				if (timestamp > 0.0)
+				{
+					input.hasTimestamp = true;
+					input.timestamp = timestamp;
+				}
+			}
+		}
+		if (asset < 0)
+		{
+			continue;
 		}
+
+		state->assetInputs[asset].datapoints++;
+		SimpleExpression::Evaluator& evaluator = *state->evaluators[asset];
+		int slot = evaluator.findVariable(v.name, strlen(v.name));
+		if (slot < 0 || evaluator.isStringSlot(slot))
+		{
+			dropped++;
+			continue;
+		}
+		evaluator.setVariable(slot, v.value);
+	}
+	if (dropped)
+	{
+		rule->getMetrics().add(RuleMetrics::DroppedDatapoints, dropped);
 	}
 
-	// Set final state: true is all calls to evalAsset() returned true
-	rule->setState(eval);
+	bool eval = rule->evalReading(*state);
+
+	rule->getMetrics().addLatency(traceClock() - start);
 
 	return eval;
 }
 
+/**
+ * Evaluate a batch of notification data
+ *
+ * The readings are parsed in a single pass. Expressions supported by
+ * the vector kernel are evaluated column-wise over the whole batch,
+ * the others reading by reading with exprtk. In both cases the rule
+ * state is set for each reading in order: the result is the same as
+ * calling plugin_eval() for each reading in turn.
+ *
+ * If the data can not be parsed the results only hold the readings
+ * evaluated before the parse error.
+ *
+ * @param    readings		JSON array of notification data
+ *				documents, as passed to plugin_eval()
+ * @param    results		Output evaluation of each reading
+ * @return			True if the rule is triggered after
+ *				the last reading, false otherwise.
+ */
+bool plugin_eval_batch(PLUGIN_HANDLE handle,
+		       const string& readings,
+		       vector<bool>& results)
+{
+	SimpleExpression* rule = (SimpleExpression *)handle;
+
+	HOTPATH_DEBUG(rule, "plugin_eval_batch(): readings=%s", readings.c_str());
+
+	results.clear();
+
+	// The whole batch is evaluated with the same configuration
+	shared_ptr<SimpleExpression::RuleState> state = rule->getState();
+
+	rule->startBatch(*state);
+	ReadingHandler handler(*rule, *state, &results);
+	bool rv = parseData(rule, readings, handler);
+	rule->finishBatch(*state, results);
+
+	return rv && !results.empty() && results.back();
+}
+
 /**
  * Return rule trigger reason: trigger or clear the notification. 
  *
@@ -252,19 +572,67 @@ string plugin_reason(PLUGIN_HANDLE handle)
 	BuiltinRule::TriggerInfo info;
 	rule->getFullState(info);
 
-	string ret = "{ \"reason\": \"";
-	ret += info.getState() == BuiltinRule::StateTriggered ? "triggered" : "cleared";
-	ret += "\"";
-	ret += ", \"asset\": " + info.getAssets();
+	// Built in the rule buffer, which keeps its capacity
+	// across calls: only the returned copy is allocated
+	string& reason = rule->getReasonBuffer();
+	reason.assign("{ \"reason\": \"");
+	reason.append(info.getState() == BuiltinRule::StateTriggered ? "triggered" : "cleared");
+	reason.append("\", \"asset\": ");
+	reason.append(info.getAssets());
+	if (info.getState() == BuiltinRule::StateTriggered)
+	{
+		// The most severe named expression that triggered
+		string severity = rule->getSeverity();
+		if (!severity.empty())
+		{
+			reason.append(", \"severity\": \"");
+			reason.append(severity);
+			reason.append("\"");
+		}
+	}
 	if (rule->getEvalTimestamp())
 	{
-		ret += string(", \"timestamp\": \"") + info.getUTCTimestamp() + string("\"");
+		reason.append(", \"timestamp\": \"");
+		reason.append(info.getUTCTimestamp());
+		reason.append("\"");
 	}
-	ret += " }";
+	reason.append(" }");
 
-	Logger::getLogger()->debug("plugin_reason(): ret=%s", ret.c_str());
+	HOTPATH_DEBUG(rule, "plugin_reason(): ret=%s", reason.c_str());
 
-	return ret;
+	return reason;
+}
+
+/**
+ * Return the rule runtime metrics
+ *
+ * The counters cover the rule lifetime, across reconfigurations:
+ * evaluations, parse errors, expression compilations and compile
+ * errors, NaN or infinite results, datapoints received for the
+ * configured assets but not used, notification state changes
+ * and readings skipped by the evaluation throttling.
+ * The latency histogram covers the plugin_eval() calls.
+ *
+ * @return	A JSON string
+ */
+string plugin_metrics(PLUGIN_HANDLE handle)
+{
+	SimpleExpression* rule = (SimpleExpression *)handle;
+	return rule->getMetrics().toJSON();
+}
+
+/**
+ * Return the stage timings of the latest traced evaluations
+ *
+ * Tracing is enabled by the traceSampling configuration item.
+ * The durations are in nanoseconds.
+ *
+ * @return	A JSON string
+ */
+string plugin_trace(PLUGIN_HANDLE handle)
+{
+	SimpleExpression* rule = (SimpleExpression *)handle;
+	return rule->getTraceRing().toJSON();
 }
 
 /**
@@ -289,153 +657,1034 @@ void plugin_reconfigure(PLUGIN_HANDLE handle,
 };
 
 /**
- * Evaluate datapoints values for the given asset name
+ * Return the current time in seconds, for the readings
+ * without a timestamp
+ */
+static double currentTime()
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+/**
+ * Evaluate the reading the handler has just bound and set
+ * the rule state
  *
- * @param    assetValue		JSON object with datapoints
+ *  Note: with the "All" combination all assets must trigger in order
+ *  to return TRUE, with "Any" one asset triggering is enough
  *
- * @return		True if evalution succeded,
- *				false otherwise.
+ * @param    state	The rule configuration in use
+ * @param    sample	The trace sample of the call, if traced
+ * @return		True if the rule was triggered,
+ *			false otherwise.
  */
-bool SimpleExpression::evalAsset(const Value& assetValue)
+bool SimpleExpression::evalReading(RuleState& state, TraceSample *sample)
 {
-	bool foundDatapoints = false;
-	bool assetEval = false;
-	
-	for (auto &m : assetValue.GetObject())
-	{
-		foundDatapoints = true;
-		double value;
-		if (m.value.IsDouble())
-		{
-			value = (double) m.value.GetDouble();
-		}
-		else if (m.value.IsNumber())
-		{
-			value = (double) m.value.GetInt();
-		}
-		else
-		{
-			value = 0.0;
-		}
+	return this->evalRow(state, -1, sample);
+}
 
-		if (m.value.IsDouble() ||
-		    m.value.IsNumber())
-		{
-			// Add variable
-			this->getEvaluator()->addVariable(m.name.GetString(), value);
-		}
+/**
+ * Return true if a plugin_eval() call has to be traced
+ *
+ * @param    state	The rule configuration in use
+ * @param    sample	The sample to initialise
+ * @return		True one call every traceSampling
+ */
+bool SimpleExpression::sampleTrace(RuleState& state, TraceSample& sample)
+{
+	if (!state.traceSampling)
+	{
+		return false;
 	}
-
-	if (!foundDatapoints)
+	m_traceCount++;
+	if (m_traceCount % state.traceSampling)
 	{
-		Logger::getLogger()->info("Couldn't find any valid datapoint in plugin_eval input data");
 		return false;
 	}
+	sample.evaluation = m_traceCount;
+	return true;
+}
 
-	typedef exprtk::parser_error::type error_t;
-
-	// Get expression from config
-	string expression = this->getTrigger();
-
-	// Update SymbolTable of Evaluator
-	this->getEvaluator()->registerSymbolTable();
+/**
+ * Turn the time points of a traced call into stage durations
+ * and add the sample to the trace ring
+ *
+ * @param    sample	The sample of the call
+ * @param    end	The time the call completed
+ * @param    result	The call result
+ */
+void SimpleExpression::endTrace(TraceSample& sample, uint64_t end, bool result)
+{
+	sample.state = end - sample.evaluate;
+	sample.evaluate -= sample.parse;
+	sample.parse -= sample.start;
+	sample.result = result;
+	m_traceRing.push(sample);
+}
 
-	// Parse and comoile expression with variables
-	if (!this->getEvaluator()->parserCompile(expression))
+/**
+ * Evaluate a reading and set the rule state
+ *
+ * Once triggered, the rule clears when the clear expression, if any,
+ * is true. The new state is then only set if the evaluation result
+ * holds for the configured number of readings and time.
+ *
+ * @param    state	The rule configuration in use
+ * @param    row	The batch row evaluated by the vector kernel
+ *			or -1 to evaluate the bound variables
+ * @param    sample	The trace sample of the call, if traced
+ * @return		True if the rule is triggered
+ */
+bool SimpleExpression::evalRow(RuleState& state, long row, TraceSample *sample)
+{
+	this->checkGeneration(state);
+	if (this->throttle(state, row))
 	{
-		Logger::getLogger()->error("Failed to compile expression: Error: %s\tExpression: %s",
-					   this->getEvaluator()->getError().c_str(),
-					   expression.c_str());
-
-		return false;
+		this->updateWindows(state, row);
+		m_metrics.add(RuleMetrics::ThrottledReadings);
+		if (sample)
+		{
+			sample->evaluate = traceClock();
+		}
+		return m_triggered;
 	}
 
-	// Evaluate the expression
-	double evaluation = this->getEvaluator()->evaluate();
-
-	Logger::getLogger()->debug("SimpleExpression::Evaluator::evaluate(): m_expression.value()=%lf",
-				   evaluation);
+	m_metrics.add(RuleMetrics::Evaluations);
 
-	// Checks
-	if (std::isnan(evaluation) || !isfinite(evaluation))
+	bool eval;
+	if (m_triggered && !state.clearExpression.empty())
 	{
-		Logger::getLogger()->error("SimpleExpression::evalAsset(): unable to evaluate expression");
+		eval = !this->evalAssets(state, row, true);
+	}
+	else
+	{
+		eval = this->evalAssets(state, row, false);
+	}
+	if (sample)
+	{
+		sample->evaluate = traceClock();
 	}
 
-	// Set result
-	assetEval = (evaluation ==  1.0);
+	if (eval == m_triggered)
+	{
+		m_holdPending = false;
+	}
+	else
+	{
+		// The result differs from the state: start or
+		// go on counting how long it holds
+		double now = state.holdTime > 0.0 ? this->readingTime(state, row) : 0.0;
+		if (!m_holdPending)
+		{
+			m_holdPending = true;
+			m_holdCount = 0;
+			m_holdSince = now;
+		}
+		m_holdCount++;
+		if (m_holdCount >= state.holdReadings &&
+		    now - m_holdSince >= state.holdTime)
+		{
+			m_metrics.add(RuleMetrics::StateChanges);
+			m_triggered = eval;
+			m_holdPending = false;
+		}
+	}
 
-	Logger::getLogger()->debug("m_triggerExpression->evaluate() returned assetEval=%s",
-				   assetEval ? "true" : "false");
+	// Set final state
+	this->setState(m_triggered);
 
-	// Return evaluation for current asset
-	return assetEval;
+	return m_triggered;
 }
 
 /**
- * SimpleExpression rule constructor
+ * Start the hold and throttling progress again if the expressions
+ * of the state in use are not those it was made with
  *
- * Call parent class BuiltinRule constructor
- * passing a plugin handle
+ * The progress belongs to the evaluating thread: configure() only
+ * changes the state generation, so it never writes the progress
+ * while an evaluation updates it.
+ *
+ * @param    state	The rule configuration in use
  */
-SimpleExpression::SimpleExpression() : BuiltinRule()
+void SimpleExpression::checkGeneration(const RuleState& state)
 {
-	m_triggerExpression = new Evaluator();
+	if (state.generation != m_generation)
+	{
+		m_generation = state.generation;
+		m_holdPending = false;
+		m_holdCount = 0;
+		m_holdSince = 0.0;
+		m_throttleCount = 0;
+		m_throttleStarted = false;
+		m_lastEvaluation = 0.0;
+	}
 }
 
 /**
- * SimpleExpression destructor
+ * Return true if the evaluation of a reading is throttled
+ *
+ * With evaluateEvery set to N the first reading of every N is
+ * evaluated, with evaluateInterval the first reading at least the
+ * interval after the previous evaluation, in reading time. A time
+ * going backwards restarts the interval. With both options set both
+ * must let the reading through.
+ *
+ * @param    state	The rule configuration in use
+ * @param    row	The batch row or -1 for the reading
+ *			the handler has just bound
+ * @return		True if the reading is not to be evaluated
  */
-SimpleExpression::~SimpleExpression()
+bool SimpleExpression::throttle(RuleState& state, long row)
 {
-	delete m_triggerExpression;
+	if (state.evaluateEvery > 1 &&
+	    m_throttleCount++ % state.evaluateEvery != 0)
+	{
+		return true;
+	}
+	if (state.evaluateInterval > 0.0)
+	{
+		double now = this->readingTime(state, row);
+		if (m_throttleStarted &&
+		    now >= m_lastEvaluation &&
+		    now - m_lastEvaluation < state.evaluateInterval)
+		{
+			return true;
+		}
+		m_throttleStarted = true;
+		m_lastEvaluation = now;
+	}
+	return false;
 }
 
 /**
- * Configure the rule plugin
+ * Add a reading to the windowed functions of the assets it holds
  *
- * @param    config	The configuration object to process
+ * Batch rows evaluated column-wise have no windowed functions.
+ *
+ * @param    state	The rule configuration in use
+ * @param    row	The batch row or -1 for the reading
+ *			the handler has just bound
  */
-bool SimpleExpression::configure(const ConfigCategory& config)
+void SimpleExpression::updateWindows(RuleState& state, long row)
 {
-	string assetName =  config.getValue("asset");
-	string expression =  config.getValue("expression");
-
-	if (assetName.empty() ||
-	    expression.empty())
+	if (row >= 0)
 	{
-		Logger::getLogger()->warn("Empty values for 'asset' or 'expression'");
-
+		return;
+	}
+	for (size_t i = 0; i < state.assetNames.size(); i++)
+	{
+		const AssetInput& input = state.assetInputs[i];
+		if (input.found && state.evaluators[i]->hasWindows())
+		{
+			state.evaluators[i]->updateWindows(input.hasTimestamp ?
+							   input.timestamp :
+							   currentTime());
+		}
+	}
+}
+
+/**
+ * Return the time of a reading: the latest timestamp of the
+ * assets it holds, or the current time
+ *
+ * @param    state	The rule configuration in use
+ * @param    row	The batch row or -1 for the reading
+ *			the handler has just bound
+ * @return		The reading time in seconds
+ */
+double SimpleExpression::readingTime(RuleState& state, long row)
+{
+	size_t assetCount = state.assetNames.size();
+	bool found = false;
+	double timestamp = 0.0;
+	for (size_t i = 0; i < assetCount; i++)
+	{
+		const AssetInput& input = row < 0 ?
+					  state.assetInputs[i] :
+					  state.batchRows[row * assetCount + i].input;
+		if (input.found && input.hasTimestamp &&
+		    (!found || input.timestamp > timestamp))
+		{
+			timestamp = input.timestamp;
+			found = true;
+		}
+	}
+	return found ? timestamp : currentTime();
+}
+
+/**
+ * Evaluate the configured assets for a reading and combine
+ * the results
+ *
+ * Evaluation stops at the first asset that decides the result:
+ * the first false one for "All", the first true one for "Any".
+ * The clear expression combines the other way round: with "All"
+ * the rule clears when it is true for any asset.
+ *
+ * @param    state	The rule configuration in use
+ * @param    row	The batch row evaluated by the vector kernel
+ *			or -1 to evaluate the bound variables
+ * @param    clear	True to evaluate the clear expression
+ * @return		The combined evaluation
+ */
+bool SimpleExpression::evalAssets(RuleState& state, long row, bool clear)
+{
+	size_t assetCount = state.assetNames.size();
+
+	// Add evalution timestamp
+	for (size_t i = 0; i < assetCount; i++)
+	{
+		const AssetInput& input = row < 0 ?
+					  state.assetInputs[i] :
+					  state.batchRows[row * assetCount + i].input;
+		if (input.found && input.hasTimestamp)
+		{
+			this->setEvalTimestamp(input.timestamp);
+		}
+		if (!clear)
+		{
+			state.evaluators[i]->setSeverity(-1);
+		}
+	}
+
+	// Windowed functions take every reading of the asset,
+	// whichever asset decides the result
+	this->updateWindows(state, row);
+
+	bool matchAll = clear ? !state.matchAll : state.matchAll;
+	bool eval = assetCount > 0 && matchAll;
+	for (size_t i = 0; i < assetCount; i++)
+	{
+		if (this->evalAsset(state, i, row, clear) != matchAll)
+		{
+			eval = !matchAll;
+			break;
+		}
+	}
+
+	return eval;
+}
+
+/**
+ * Evaluate one configured asset for a reading
+ *
+ * @param    state	The rule configuration in use
+ * @param    asset	The asset position
+ * @param    row	The batch row evaluated by the vector kernel
+ *			or -1 to evaluate the bound variables
+ * @param    clear	True to evaluate the clear expression
+ * @return		The asset evaluation
+ */
+bool SimpleExpression::evalAsset(RuleState& state, size_t asset, long row, bool clear)
+{
+	const AssetInput& input = row < 0 ?
+				  state.assetInputs[asset] :
+				  state.batchRows[row * state.assetNames.size() + asset].input;
+	if (!input.found)
+	{
+		return false;
+	}
+	if (!input.datapoints)
+	{
+		Logger::getLogger()->info("Couldn't find any valid datapoint in plugin_eval input data");
+		return false;
+	}
+	if (row < 0)
+	{
+		return this->evalVariables(state, asset, clear);
+	}
+	bool result = state.batchRows[row * state.assetNames.size() + asset].bound &&
+		      state.batchResults[asset * state.batchRowCount + row];
+	if (!clear)
+	{
+		state.evaluators[asset]->setSeverity(result ? 0 : -1);
+	}
+	return result;
+}
+
+/**
+ * Set up the parallel evaluation of batches
+ *
+ * With more than one worker configured, and if the rows of each
+ * asset batch can be evaluated in any order, each worker gets its
+ * own Evaluator for each asset: exprtk expressions and the kernel
+ * scratch data can not be shared between threads.
+ *
+ * @param    state	The rule configuration being built
+ */
+void SimpleExpression::configureWorkers(RuleState& state)
+{
+	if (state.workers < 2)
+	{
+		return;
+	}
+	for (auto &evaluator : state.evaluators)
+	{
+		if (!evaluator->isParallel())
+		{
+			Logger::getLogger()->info("The expression '%s' is not evaluated "
+						  "by the batch workers",
+						  state.expression.c_str());
+			return;
+		}
+	}
+
+	for (unsigned long w = 0; w < state.workers; w++)
+	{
+		for (size_t a = 0; a < state.evaluators.size(); a++)
+		{
+			state.workerEvaluators.push_back(this->createEvaluator(state));
+		}
+	}
+	state.pool.reset(new WorkerPool(state.workers));
+}
+
+/**
+ * Create and configure an Evaluator of the rule expressions
+ *
+ * If the expressions do not compile with the variables restored
+ * from the BindingStore, the stored variables are stale: they are
+ * discarded and the Evaluator is configured again with the variables
+ * resolved from the expressions, which replace the stored ones.
+ *
+ * @param    state	The rule configuration being built
+ * @return		The Evaluator, isCompiled() is false on error
+ */
+shared_ptr<SimpleExpression::Evaluator> SimpleExpression::createEvaluator(const RuleState& state)
+{
+	shared_ptr<Evaluator> evaluator(new Evaluator());
+	bool compiled = evaluator->configure(state.expressions,
+					     state.clearExpression,
+					     state.singlePrecision);
+	m_metrics.add(RuleMetrics::Compiles, evaluator->getCompileCount());
+	if (!compiled && evaluator->isRestored())
+	{
+		ExpressionCache::getInstance().discard(evaluator->getTemplate());
+		evaluator.reset(new Evaluator());
+		evaluator->configure(state.expressions,
+				     state.clearExpression,
+				     state.singlePrecision);
+		m_metrics.add(RuleMetrics::Compiles, evaluator->getCompileCount());
+	}
+	return evaluator;
+}
+
+/**
+ * Prepare the evaluation of a batch of readings
+ *
+ * The batch is evaluated column-wise if the expression compiled
+ * to a vector kernel, or by the worker pool if there is one.
+ *
+ * @param    state	The rule configuration in use
+ */
+void SimpleExpression::startBatch(RuleState& state)
+{
+	// The expression is the same for all assets, there is
+	// no kernel with a clear expression
+	state.columnarBatch = !state.evaluators.empty() &&
+			      (state.evaluators[0]->hasKernel() || state.pool);
+	if (state.columnarBatch)
+	{
+		state.batchRows.clear();
+		for (auto &evaluator : state.evaluators)
+		{
+			evaluator->clearRows();
+		}
+	}
+}
+
+/**
+ * A reading of a batch has been bound by the handler
+ *
+ * Without a vector kernel the reading is evaluated straight away,
+ * otherwise its values are appended to the Evaluator columns and
+ * the evaluation is left to finishBatch().
+ *
+ * @param    state	The rule configuration in use
+ * @param    results	The batch results
+ */
+void SimpleExpression::batchReading(RuleState& state,
+				    vector<bool>& results)
+{
+	if (!state.columnarBatch)
+	{
+		results.push_back(this->evalReading(state));
+		return;
+	}
+
+	for (size_t i = 0; i < state.assetNames.size(); i++)
+	{
+		Evaluator& evaluator = *state.evaluators[i];
+		BatchRow row;
+		row.input = state.assetInputs[i];
+		row.bound = evaluator.isCompiled() && evaluator.isBound();
+		state.batchRows.push_back(row);
+		evaluator.appendRow();
+	}
+	results.push_back(false);
+}
+
+/**
+ * Complete the evaluation of a batch
+ *
+ * In columnar mode the kernel evaluates all the rows of each asset
+ * at once, then the rule state is set for each reading in order as
+ * evalReading() would have done. With a worker pool the rows of
+ * each asset are split in chunks of BATCH_CHUNK_ROWS evaluated
+ * concurrently, each worker with its own Evaluator copies.
+ *
+ * @param    state	The rule configuration in use
+ * @param    results	The batch results
+ */
+void SimpleExpression::finishBatch(RuleState& state,
+				   vector<bool>& results)
+{
+	if (!state.columnarBatch)
+	{
+		return;
+	}
+
+	size_t rows = results.size();
+	size_t assetCount = state.assetNames.size();
+	state.batchRowCount = rows;
+	if (state.batchResults.size() < rows * assetCount)
+	{
+		state.batchResults.resize(rows * assetCount);
+	}
+	if (state.pool)
+	{
+		size_t chunks = (rows + BATCH_CHUNK_ROWS - 1) / BATCH_CHUNK_ROWS;
+		atomic<size_t> invalid(0);
+		state.pool->run(chunks * assetCount, [&](size_t task, size_t worker)
+		{
+			size_t asset = task / chunks;
+			size_t first = (task % chunks) * BATCH_CHUNK_ROWS;
+			size_t count = min((size_t) BATCH_CHUNK_ROWS, rows - first);
+			Evaluator& evaluator = *state.workerEvaluators[worker * assetCount + asset];
+			invalid += evaluator.evaluateRows(*state.evaluators[asset],
+							  first,
+							  count,
+							  state.batchResults.data() + asset * rows + first);
+		});
+		if (invalid)
+		{
+			m_metrics.add(RuleMetrics::InvalidResults, invalid);
+			Logger::getLogger()->error("SimpleExpression::evalAsset(): unable to evaluate expression");
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < assetCount; i++)
+		{
+			Evaluator& evaluator = *state.evaluators[i];
+			evaluator.evaluateRows(evaluator,
+					       0,
+					       rows,
+					       state.batchResults.data() + i * rows);
+		}
+	}
+
+	for (size_t r = 0; r < rows; r++)
+	{
+		results[r] = this->evalRow(state, r);
+	}
+}
+
+/**
+ * Evaluate the expression with the values currently bound
+ * to the Evaluator variables
+ *
+ * @param    state	The rule configuration in use
+ * @param    asset	The asset position
+ * @param    clear	True to evaluate the clear expression
+ * @return		True if the expression evaluated to true,
+ *				false otherwise.
+ */
+bool SimpleExpression::evalVariables(RuleState& state, size_t asset, bool clear)
+{
+	bool assetEval = false;
+	Evaluator& evaluator = *state.evaluators[asset];
+
+	if (!evaluator.isCompiled())
+	{
+		return false;
+	}
+
+	if (!evaluator.isBound())
+	{
+		HOTPATH_DEBUG(this, "Not all the datapoints referenced by expression '%s' "
+			      "have been received yet",
+			      state.expression.c_str());
+		return false;
+	}
+
+	if (clear)
+	{
+		double evaluation = evaluator.evaluateClear();
+
+		HOTPATH_DEBUG(this, "SimpleExpression::Evaluator::evaluateClear()=%lf",
+			      evaluation);
+
+		this->checkResult(evaluation);
+		return evaluation == 1.0;
+	}
+
+	// Evaluate the expressions: the asset triggers if any of the
+	// trigger expressions is true, the last one is the severity
+	evaluator.evaluate();
+	int severity = -1;
+	for (size_t i = 0; i < evaluator.getExpressionCount(); i++)
+	{
+		double evaluation = evaluator.getResult(i);
+
+		HOTPATH_DEBUG(this, "SimpleExpression::Evaluator::evaluate(): expression %lu value=%lf",
+			      (unsigned long)i, evaluation);
+
+		this->checkResult(evaluation);
+		if (evaluator.isTrigger(i) && evaluation == 1.0)
+		{
+			severity = i;
+		}
+	}
+	evaluator.setSeverity(severity);
+
+	// Set result
+	assetEval = severity >= 0;
+
+	HOTPATH_DEBUG(this, "Evaluator::evaluate() returned assetEval=%s",
+		      assetEval ? "true" : "false");
+
+	// Return evaluation for current asset
+	return assetEval;
+}
+
+/**
+ * Check an expression result is a number
+ *
+ * @param    evaluation	The expression result
+ */
+void SimpleExpression::checkResult(double evaluation)
+{
+	if (std::isnan(evaluation) || !isfinite(evaluation))
+	{
+		m_metrics.add(RuleMetrics::InvalidResults);
+		Logger::getLogger()->error("SimpleExpression::evalAsset(): unable to evaluate expression");
+	}
+}
+
+/**
+ * Return the name of the last rule expression that triggered
+ * with the latest evaluation
+ *
+ * @return	The expression name, or an empty string if the rule
+ *		has no named expressions or none triggered
+ */
+string SimpleExpression::getSeverity()
+{
+	shared_ptr<RuleState> state = this->getState();
+	int severity = -1;
+	if (state->named)
+	{
+		for (auto &evaluator : state->evaluators)
+		{
+			if (evaluator->getSeverity() > severity)
+			{
+				severity = evaluator->getSeverity();
+			}
+		}
+	}
+	return severity < 0 ? "" : state->expressions[severity].name;
+}
+
+/**
+ * Parse the expression configuration item
+ *
+ * The item is either an expression or a JSON array of named
+ * expressions, evaluated in order:
+ *
+ *	[ { "name" : "level", "expression" : "sqrt(x^2 + y^2)", "trigger" : false },
+ *	  { "name" : "warning", "expression" : "level > 10" },
+ *	  { "name" : "alarm", "expression" : "level > 20" } ]
+ *
+ * @param    item	The configuration item value
+ * @param    state	The rule state to fill in
+ * @return		False if the item is not valid
+ */
+bool SimpleExpression::parseExpressions(const string& item, RuleState& state)
+{
+	state.expression = item;
+
+	size_t first = item.find_first_not_of(" \t\r\n");
+	Document doc;
+	if (first == string::npos || item[first] != '[' ||
+	    doc.Parse(item.c_str()).HasParseError() || !doc.IsArray())
+	{
+		// A single expression
+		NamedExpression e;
+		e.expression = item;
+		e.trigger = true;
+		state.expressions.push_back(e);
+		return true;
+	}
+
+	state.named = true;
+	for (auto &v : doc.GetArray())
+	{
+		if (!v.IsObject() ||
+		    !v.HasMember("name") || !v["name"].IsString() ||
+		    !v.HasMember("expression") || !v["expression"].IsString() ||
+		    (v.HasMember("trigger") && !v["trigger"].IsBool()))
+		{
+			Logger::getLogger()->error("Each expression must have a 'name' "
+						   "and an 'expression' string");
+			return false;
+		}
+		NamedExpression e;
+		e.name = v["name"].GetString();
+		e.expression = v["expression"].GetString();
+		e.trigger = !v.HasMember("trigger") || v["trigger"].GetBool();
+
+		// The name is an exprtk variable
+		if (e.name.empty() || !isalpha(e.name[0]) ||
+		    e.name.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
+					     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+					     "0123456789_") != string::npos ||
+		    strncasecmp(e.name.c_str(), WINDOW_VARIABLE_PREFIX,
+				strlen(WINDOW_VARIABLE_PREFIX)) == 0)
+		{
+			Logger::getLogger()->error("Expression name '%s' is not valid",
+						   e.name.c_str());
+			return false;
+		}
+		for (auto &n : state.expressions)
+		{
+			if (strcasecmp(n.name.c_str(), e.name.c_str()) == 0)
+			{
+				Logger::getLogger()->error("Expression name '%s' is used twice",
+							   e.name.c_str());
+				return false;
+			}
+		}
+		state.expressions.push_back(e);
+	}
+
+	if (state.expressions.empty())
+	{
+		Logger::getLogger()->error("The expression list is empty");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * SimpleExpression rule constructor
+ *
+ * Call parent class BuiltinRule constructor
+ * passing a plugin handle
+ */
+SimpleExpression::SimpleExpression() : BuiltinRule(),
+				       m_state(new RuleState()),
+				       m_triggered(false),
+				       m_generation(0),
+				       m_holdPending(false),
+				       m_holdCount(0),
+				       m_holdSince(0.0),
+				       m_throttleCount(0),
+				       m_throttleStarted(false),
+				       m_lastEvaluation(0.0),
+				       m_triggersJSON("{\"triggers\" : []}"),
+				       m_traceCount(0)
+{
+	this->refreshLogLevel();
+}
+
+/**
+ * SimpleExpression destructor
+ */
+SimpleExpression::~SimpleExpression()
+{
+}
+
+/**
+ * Cache whether debug messages are logged, so that the evaluation
+ * path does not build debug messages that would be discarded
+ *
+ * The FogLAMP logger sets its level with setlogmask(): calling it
+ * with a zero mask returns the current mask without changing it.
+ */
+void SimpleExpression::refreshLogLevel()
+{
+	m_debugEnabled = (setlogmask(0) & LOG_MASK(LOG_DEBUG)) != 0;
+}
+
+/**
+ * Configure the rule plugin
+ *
+ * Only what changed is rebuilt: with the same expressions the
+ * Evaluators of the assets still configured are kept, with their
+ * windowed functions and cached results, and the triggers are only
+ * set again if the asset list changed. A configuration with no
+ * change is ignored.
+ *
+ * @param    config	The configuration object to process
+ */
+bool SimpleExpression::configure(const ConfigCategory& config)
+{
+	// Pick up a log level change made since the last configure
+	this->refreshLogLevel();
+
+	string assetName =  config.getValue("asset");
+	string expression =  config.getValue("expression");
+	string clearExpression = config.itemExists("clearExpression") ?
+				 config.getValue("clearExpression") : "";
+
+	// A comma separated list of asset names
+	vector<string> assetNames;
+	size_t start = 0;
+	while (start <= assetName.length())
+	{
+		size_t end = assetName.find(',', start);
+		if (end == string::npos)
+		{
+			end = assetName.length();
+		}
+		size_t first = assetName.find_first_not_of(" \t", start);
+		size_t last = assetName.find_last_not_of(" \t", end - 1);
+		if (first != string::npos && first < end && last >= first)
+		{
+			string name = assetName.substr(first, last - first + 1);
+			if (std::find(assetNames.begin(), assetNames.end(), name) == assetNames.end())
+			{
+				assetNames.push_back(name);
+			}
+		}
+		start = end + 1;
+	}
+
+	if (assetNames.empty() ||
+	    expression.empty())
+	{
+		Logger::getLogger()->warn("Empty values for 'asset' or 'expression'");
+
 		// Return true, so it can be configured later
 		return true;
 	}
 
-	this->lockConfig();
+	// Build the new state without holding the lock:
+	// evaluations go on with the current one meanwhile
+	shared_ptr<RuleState> state(new RuleState());
+	if (!this->parseExpressions(expression, *state))
+	{
+		// Keep the current configuration
+		return true;
+	}
+	state->matchAll = !config.itemExists("combine") ||
+			  config.getValue("combine").compare("Any") != 0;
+	if (clearExpression.find_first_not_of(" \t\r\n") != string::npos)
+	{
+		state->clearExpression = clearExpression;
+	}
+	if (config.itemExists("holdReadings"))
+	{
+		long readings = atol(config.getValue("holdReadings").c_str());
+		state->holdReadings = readings > 1 ? readings : 1;
+	}
+	if (config.itemExists("traceSampling"))
+	{
+		long sampling = atol(config.getValue("traceSampling").c_str());
+		state->traceSampling = sampling > 0 ? sampling : 0;
+	}
+	if (config.itemExists("holdTime"))
+	{
+		double seconds = atof(config.getValue("holdTime").c_str());
+		state->holdTime = seconds > 0.0 ? seconds : 0.0;
+	}
+	state->singlePrecision = config.itemExists("precision") &&
+				 config.getValue("precision").compare("float") == 0;
+	if (config.itemExists("workers"))
+	{
+		long workers = atol(config.getValue("workers").c_str());
+		long processors = std::thread::hardware_concurrency();
+		long maxWorkers = processors > 0 ? processors : BATCH_MAX_WORKERS;
+		if (workers > maxWorkers)
+		{
+			Logger::getLogger()->warn("SimpleExpression: %ld workers configured, "
+						  "limited to %ld",
+						  workers,
+						  maxWorkers);
+			workers = maxWorkers;
+		}
+		state->workers = workers > 1 ? workers : 1;
+	}
+	if (config.itemExists("evaluateInterval"))
+	{
+		long milliseconds = atol(config.getValue("evaluateInterval").c_str());
+		state->evaluateInterval = milliseconds > 0 ? milliseconds / 1000.0 : 0.0;
+	}
+	if (config.itemExists("evaluateEvery"))
+	{
+		long every = atol(config.getValue("evaluateEvery").c_str());
+		state->evaluateEvery = every > 1 ? every : 1;
+	}
 
-	if (m_triggerExpression)
+	// The GUI often saves the whole category: only rebuild
+	// what the new configuration changes
+	shared_ptr<RuleState> current = this->getState();
+	bool sameExpressions = current->expression == state->expression &&
+			       current->clearExpression == state->clearExpression &&
+			       current->singlePrecision == state->singlePrecision;
+	bool sameAssets = current->assetNames == assetNames;
+	if (sameExpressions && sameAssets &&
+	    current->matchAll == state->matchAll &&
+	    current->holdReadings == state->holdReadings &&
+	    current->holdTime == state->holdTime &&
+	    current->traceSampling == state->traceSampling &&
+	    current->workers == state->workers &&
+	    current->evaluateInterval == state->evaluateInterval &&
+	    current->evaluateEvery == state->evaluateEvery)
 	{
-		delete m_triggerExpression;
-		m_triggerExpression = new Evaluator();
+		Logger::getLogger()->debug("The rule configuration is unchanged");
+		return true;
 	}
-	this->setTrigger(expression);
+	// A pending hold and the throttling go on with the same
+	// expressions, the evaluating thread starts them again
+	// when the generation changes
+	state->generation = sameExpressions ? current->generation :
+					      current->generation + 1;
 
-	if (this->hasTriggers())
-	{       
-		this->removeTriggers();
+	// Each asset has its own compiled expression and variables
+	for (auto & a : assetNames)
+	{
+		// Keep the Evaluator of an asset already configured with
+		// the same expressions, its windows and cached results.
+		// The previous state may still use it, but a rule is
+		// evaluated by one thread at a time
+		if (sameExpressions)
+		{
+			auto it = std::find(current->assetNames.begin(),
+					    current->assetNames.end(),
+					    a);
+			if (it != current->assetNames.end())
+			{
+				state->evaluators.push_back(current->evaluators[it - current->assetNames.begin()]);
+				state->assetNames.push_back(a);
+				continue;
+			}
+		}
+
+		// Resolve the referenced datapoints and build the expressions
+		shared_ptr<Evaluator> evaluator = this->createEvaluator(*state);
+		if (!evaluator->isCompiled())
+		{
+			m_metrics.add(RuleMetrics::CompileErrors);
+			Logger::getLogger()->error("Failed to compile expression: Error: %s\tExpression: %s",
+						   evaluator->getError().c_str(),
+						   state->clearExpression.empty() ?
+						   expression.c_str() :
+						   (expression + "; clear: " +
+						    state->clearExpression).c_str());
+		}
+		state->evaluators.push_back(evaluator);
+		state->assetNames.push_back(a);
+	}
+	if (sameExpressions && sameAssets && current->workers == state->workers)
+	{
+		state->pool = current->pool;
+		state->workerEvaluators = current->workerEvaluators;
+	}
+	else
+	{
+		this->configureWorkers(*state);
 	}
-	this->addTrigger(assetName, NULL);
-		
+
+	// Lookup of the asset and timestamp keys in plugin_eval() data
+	vector<string> keys = state->assetNames;
+	for (auto & a : state->assetNames)
+	{
+		keys.push_back("timestamp_" + a);
+	}
+	state->assetIndex.build(keys);
+	state->assetInputs.resize(state->assetNames.size());
+
+	this->lockConfig();
+
+	if (!sameAssets)
+	{
+		if (this->hasTriggers())
+		{       
+			this->removeTriggers();
+		}
+		for (auto & a : state->assetNames)
+		{
+			this->addTrigger(a, NULL);
+		}
+		this->buildTriggersJSON();
+	}
+
+	// Publish the new state: the previous one is freed
+	// when the last evaluation using it completes
+	std::atomic_store(&m_state, state);
+
 	// Release lock
 	this->unlockConfig();
 
+	// Save the variables resolved by this configuration
+	BindingStore::getInstance().flush();
+
 	return true;
 }
 
+/**
+ * Build the plugin_triggers() document from the current triggers
+ *
+ * Called with the configuration lock held, each time the
+ * triggers change.
+ */
+void SimpleExpression::buildTriggersJSON()
+{
+	if (!this->hasTriggers())
+	{
+		m_triggersJSON = "{\"triggers\" : []}";
+		return;
+	}
+
+	m_triggersJSON = "{\"triggers\" : [ ";
+	const std::map<std::string, RuleTrigger *>& triggers = this->getTriggers();
+	for (auto it = triggers.begin();
+		  it != triggers.end();
+		  ++it)
+	{
+		if (it != triggers.begin())
+		{
+			m_triggersJSON += ", ";
+		}
+		m_triggersJSON += "{ \"asset\"  : \"" + (*it).first + "\" }";
+	}
+	m_triggersJSON += " ] }";
+}
+
 /**
  * Constructor for the evaluator class. This holds the expressions and
  * variable bindings used to execute the triggers.
  */
-SimpleExpression::Evaluator::Evaluator() : m_varCount(0)
+SimpleExpression::Evaluator::Evaluator() : m_expressionCount(0),
+					    m_hasNames(false),
+					    m_severity(-1),
+					    m_varCount(0),
+					    m_unboundCount(0),
+					    m_variableIndex(false),
+					    m_strings(true),
+					    m_compiled(false),
+					    m_hasClear(false),
+					    m_stateless(false),
+					    m_version(1),
+					    m_resultVersion(0),
+					    m_clearResultVersion(0),
+					    m_clearResult(0.0),
+					    m_compileCount(0),
+					    m_singlePrecision(false),
+					    m_rows(0)
 {
 	bool rv = m_symbolTable.add_constants();
 	if (rv == false)
@@ -443,55 +1692,382 @@ SimpleExpression::Evaluator::Evaluator() : m_varCount(0)
 		Logger::getLogger()->error("m_symbolTable.add_constants() failed");
 		throw new exception();
 	}
-	m_expression.register_symbol_table(m_symbolTable);
 }
 
 /**
- * Add a variable and its value to Evaluator symbolTable
- * If variable is already present just update the value
+ * Resolve the variables referenced by the expressions, bind them
+ * to the variable slots and compile the expressions
+ *
+ * The variable names and the vector kernel program come from the
+ * expression template shared through the ExpressionCache: rules
+ * using the same expressions pay for the parsing once.
+ * The variable set is fixed for the Evaluator lifetime:
+ * SimpleExpression::configure() creates a new Evaluator when the
+ * expressions change and keeps the existing one otherwise.
  *
- * We can add up to MAX_EXPRESSION_VARIABLES variables
+ * @param    expressions	The rule expressions, evaluated in order
+ * @param    clearExpression	The optional clear expression, evaluated
+ *				on the same variables
+ * @param    singlePrecision	Store the datapoint values as floats
+ * @return			True if the expressions have been compiled
  */
-void SimpleExpression::Evaluator::addVariable(const std::string& dapointName,
-					      double value)
+bool SimpleExpression::Evaluator::configure(const vector<NamedExpression>& expressions,
+					    const std::string& clearExpression,
+					    bool singlePrecision)
 {
-	if (!m_varCount)
+	m_singlePrecision = singlePrecision;
+	vector<string> texts;
+	vector<string> expressionNames;
+	for (auto &e : expressions)
+	{
+		texts.push_back(e.expression);
+		expressionNames.push_back(e.name);
+		m_triggers.push_back(e.trigger);
+		m_hasNames = m_hasNames || !e.name.empty();
+	}
+	m_expressionCount = expressions.size();
+	if (!clearExpression.empty())
 	{
-		m_variableNames[0] = dapointName;
-		m_variables[0] = value;
-		m_symbolTable.add_variable(m_variableNames[0],
-					   m_variables[0]);
-		m_varCount++;
+		texts.push_back(clearExpression);
+	}
+	m_template = ExpressionCache::getInstance().get(texts, expressionNames);
+	if (!m_template->isValid())
+	{
+		m_error = m_template->getError();
+		return false;
+	}
+	const vector<string>& names = m_template->getVariables();
+
+	// Size the storage before binding: element addresses
+	// must not change once added to the symbol table
+	m_varCount = names.size();
+	m_variableNames = names;
+	m_variables.assign(m_varCount, 0.0);
+	m_variableBound.assign(m_varCount, false);
+	m_variableSeen.assign(m_varCount, false);
+
+	for (int i = 0; i < m_varCount; i++)
+	{
+		m_symbolTable.add_variable(m_variableNames[i],
+					   m_variables[i]);
+	}
+	m_unboundCount = m_varCount;
+
+	// Datapoint name to slot lookup used by addVariable()
+	m_variableIndex.build(names);
+
+	// The variables compared with string literals, and
+	// those only compared with other variables
+	m_stringSlots.assign(m_varCount, false);
+	for (auto &v : m_template->getStringVariables())
+	{
+		int slot = m_variableIndex.find(v);
+		if (slot >= 0)
+		{
+			m_stringSlots[slot] = true;
+		}
+	}
+	m_stringPairSlots.assign(m_varCount, false);
+	for (auto &v : m_template->getStringPairVariables())
+	{
+		int slot = m_variableIndex.find(v);
+		if (slot >= 0)
+		{
+			m_stringPairSlots[slot] = true;
+		}
+	}
+
+	// The windowed function calls read the variables
+	// holding the function values
+	const vector<WindowDefinition>& windows = m_template->getWindows();
+	m_windowValues.assign(windows.size(), 0.0);
+	for (size_t i = 0; i < windows.size(); i++)
+	{
+		// The source is a template variable, unless the
+		// variables restored from the BindingStore are wrong
+		int source = m_variableIndex.find(windows[i].source);
+		if (source < 0)
+		{
+			m_error = "The windowed function source '" +
+				  windows[i].source + "' is not a variable";
+			return false;
+		}
+		if (m_singlePrecision)
+		{
+			m_floatWindows.push_back(WindowFunction<float>(windows[i].type,
+								       windows[i].seconds));
+		}
+		else
+		{
+			m_windows.push_back(WindowFunction<double>(windows[i].type,
+								   windows[i].seconds));
+		}
+		m_windowSources.push_back(source);
+		m_symbolTable.add_variable(windows[i].variable,
+					   m_windowValues[i]);
+	}
+
+	// The named expression results are variables too
+	m_results.assign(m_expressionCount, 0.0);
+	for (size_t i = 0; i < m_expressionCount; i++)
+	{
+		if (!expressionNames[i].empty())
+		{
+			m_symbolTable.add_variable(expressionNames[i], m_results[i]);
+		}
+	}
+
+	m_hasClear = !clearExpression.empty();
+	m_expressions.resize(texts.size());
+#ifdef SIMPLE_EXPRESSION_CLOSURES
+	m_closures.resize(texts.size());
+#endif
+	for (size_t i = 0; i < texts.size(); i++)
+	{
+		m_expressions[i].register_symbol_table(m_symbolTable);
+		if (!this->parserCompile(m_template->getCompiledExpression(i),
+					 m_expressions[i]))
+		{
+			return false;
+		}
+	}
+
+	// Results are reused while no variable changes
+	m_stateless = m_template->isStateless();
+
+	// Columnar fast path for comparison expressions: the kernel
+	// uses the slots of the template variables, as this Evaluator
+	if (m_singlePrecision)
+	{
+		m_floatColumns.resize(m_varCount);
 	}
 	else
 	{
-		bool found = false;
+		m_columns.resize(m_varCount);
+	}
+	if (m_triggers[0])
+	{
+		m_kernel = m_template->getKernel();
+	}
+	if (m_kernel.isCompiled())
+	{
+		Logger::getLogger()->debug("Expression '%s' uses the vector kernel",
+					   texts[0].c_str());
+	}
+
+	return true;
+}
+
+/**
+ * Parse and compile the expression against the bound variables
+ *
+ * This is called only by configure(): once compiled the expression
+ * is evaluated with the values set by addVariable().
+ * The exprtk expression references this Evaluator variables, so it
+ * is compiled per Evaluator, with the parser owned by the cache.
+ *
+ * @param    expression	The expression to compile
+ * @param    compiled	The rule or clear exprtk expression
+ * @return		True if the compilation succeeded
+ */
+bool SimpleExpression::Evaluator::parserCompile(const std::string& expression,
+						exprtk::expression<double>& compiled)
+{
+	m_compiled = ExpressionCache::getInstance().compile(expression,
+							    compiled,
+							    m_error);
+	m_compileCount++;
+
+	Logger::getLogger()->debug("Expression compiled %lu time(s)", m_compileCount);
+
+	return m_compiled;
+}
+
+#ifdef SIMPLE_EXPRESSION_CLOSURES
+/**
+ * Move an expression evaluated by exprtk towards closure evaluation
+ *
+ * After CLOSURE_THRESHOLD evaluations the expression is compiled to
+ * closures, which then run alongside exprtk for CLOSURE_VERIFICATIONS
+ * evaluations: if all the results are bitwise identical the closures
+ * replace exprtk, otherwise or if the expression is not supported
+ * exprtk keeps evaluating it.
+ *
+ * @param    index	The expression position
+ * @param    result	The exprtk result of the current evaluation
+ */
+void SimpleExpression::Evaluator::promote(size_t index, double result)
+{
+	ClosureState& closure = m_closures[index];
+	closure.count++;
+
+	if (closure.stage == ClosureInterpreted)
+	{
+		if (closure.count < CLOSURE_THRESHOLD)
+		{
+			return;
+		}
+
+		// Every variable the expression can read: datapoints,
+		// windowed functions and named expression results
+		ClosureProgram::Symbols symbols;
 		for (int i = 0; i < m_varCount; i++)
 		{
-			if (m_variableNames[i].compare(dapointName) == 0)
+			symbols.push_back(make_pair(m_variableNames[i], &m_variables[i]));
+		}
+		const vector<WindowDefinition>& windows = m_template->getWindows();
+		for (size_t i = 0; i < windows.size(); i++)
+		{
+			symbols.push_back(make_pair(windows[i].variable, &m_windowValues[i]));
+		}
+		for (size_t i = 0; i < m_expressionCount; i++)
+		{
+			if (!m_template->getName(i).empty())
 			{
-				found = true;
-				m_variables[i] = value;
-				break;
+				symbols.push_back(make_pair(m_template->getName(i), &m_results[i]));
 			}
 		}
 
-		if (!found)
+		closure.program.reset(new ClosureProgram());
+		if (closure.program->compile(m_template->getCompiledExpression(index), symbols))
 		{
-			if (m_varCount < MAX_EXPRESSION_VARIABLES)
-			{
-				m_variableNames[m_varCount] = dapointName;
-				m_variables[m_varCount] = value;
-				m_symbolTable.add_variable(m_variableNames[m_varCount],
-							   m_variables[m_varCount]);
-				m_varCount++;
-			}
-			else
-			{
-				Logger::getLogger()->warn("Already set %d variables, can not add the new one '%s'",
-							  MAX_EXPRESSION_VARIABLES,
-							  dapointName.c_str());
-			}
+			closure.stage = ClosureVerifying;
+			closure.count = 0;
+		}
+		else
+		{
+			Logger::getLogger()->debug("Expression '%s' is evaluated by exprtk",
+						   m_template->getExpression(index).c_str());
+			closure.stage = ClosureUnsupported;
+			closure.program.reset();
+		}
+		return;
+	}
+
+	double compiled = closure.program->evaluate();
+	if (memcmp(&compiled, &result, sizeof(double)) != 0)
+	{
+		Logger::getLogger()->debug("Expression '%s' closures differ from exprtk: %.17g, %.17g",
+					   m_template->getExpression(index).c_str(),
+					   compiled, result);
+		closure.stage = ClosureUnsupported;
+		closure.program.reset();
+	}
+	else if (closure.count >= CLOSURE_VERIFICATIONS)
+	{
+		Logger::getLogger()->debug("Expression '%s' is evaluated by closures",
+					   m_template->getExpression(index).c_str());
+		closure.stage = ClosureNative;
+	}
+}
+#endif
+
+/**
+ * Add the values received with a reading to the windowed functions
+ *
+ * Only the datapoints set since the previous call add a sample:
+ * variables keep their value when a reading does not carry them.
+ *
+ * @param    timestamp	The reading timestamp in seconds
+ */
+void SimpleExpression::Evaluator::updateWindows(double timestamp)
+{
+	for (size_t i = 0; i < m_windowSources.size(); i++)
+	{
+		int slot = m_windowSources[i];
+		if (!m_variableSeen[slot])
+		{
+			continue;
+		}
+		if (m_singlePrecision)
+		{
+			m_windowValues[i] = m_floatWindows[i].update(timestamp,
+								     m_variables[slot]);
+		}
+		else
+		{
+			m_windowValues[i] = m_windows[i].update(timestamp,
+								m_variables[slot]);
+		}
+	}
+	m_variableSeen.assign(m_varCount, false);
+}
+
+/**
+ * Evaluate rows of a batch collected by appendRow()
+ *
+ * The rows are those of source, an Evaluator configured with the
+ * same expression, possibly this one. The vector kernel or the
+ * exprtk expression of this Evaluator, and its variables for the
+ * latter, are used: copies of an Evaluator can evaluate distinct
+ * rows of the same batch concurrently. Only rule expressions for
+ * which isParallel() is true are evaluated with exprtk.
+ *
+ * @param    source	The Evaluator holding the rows
+ * @param    first	The first row to evaluate
+ * @param    count	The number of rows
+ * @param    results	Output, 1 where the expression is true
+ * @return		The number of NaN or infinite results
+ */
+size_t SimpleExpression::Evaluator::evaluateRows(const Evaluator& source,
+						 size_t first,
+						 size_t count,
+						 unsigned char *results)
+{
+	if (m_kernel.isCompiled())
+	{
+		if (m_singlePrecision)
+		{
+			m_kernel.evaluate(source.m_floatColumns, first, count, results);
 		}
+		else
+		{
+			m_kernel.evaluate(source.m_columns, first, count, results);
+		}
+		return 0;
 	}
+
+	size_t invalid = 0;
+	for (size_t r = 0; r < count; r++)
+	{
+		for (int i = 0; i < m_varCount; i++)
+		{
+			m_variables[i] = m_singlePrecision ?
+					 source.m_floatColumns[i][first + r] :
+					 source.m_columns[i][first + r];
+		}
+		double evaluation = this->value(0);
+		if (!isfinite(evaluation))
+		{
+			invalid++;
+		}
+		results[r] = evaluation == 1.0;
+	}
+	m_version++;
+	return invalid;
+}
+
+/**
+ * Set the value of a variable referenced by the expression
+ *
+ * The datapoint name is looked up in the variable index built
+ * by configure(): datapoints the expression does not reference
+ * are ignored and the symbol table is never changed.
+ *
+ * @param    dapointName	The datapoint name, not necessarily
+ *				null terminated
+ * @param    length		The datapoint name length
+ * @param    value		The datapoint value
+ */
+void SimpleExpression::Evaluator::addVariable(const char *dapointName,
+					      size_t length,
+					      double value)
+{
+	int slot = m_variableIndex.find(dapointName, length);
+	if (slot < 0)
+	{
+		return;
+	}
+
+	this->setVariable(slot, value);
 }
@@ -0,0 +1,98 @@
+/**
+ * FogLAMP SimpleExpression runtime metrics
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <rule_metrics.h>
+
+using namespace std;
+
+/**
+ * Constructor
+ */
+RuleMetrics::RuleMetrics()
+{
+	for (auto &c : m_counters)
+	{
+		c.store(0, memory_order_relaxed);
+	}
+	for (auto &b : m_latency)
+	{
+		b.store(0, memory_order_relaxed);
+	}
+}
+
+/**
+ * Count an evaluation latency in the histogram
+ *
+ * @param    nanoseconds	The evaluation duration
+ */
+void RuleMetrics::addLatency(unsigned long nanoseconds)
+{
+	int bucket = 0;
+	while (nanoseconds > 1 && bucket < METRICS_LATENCY_BUCKETS - 1)
+	{
+		nanoseconds >>= 1;
+		bucket++;
+	}
+	m_latency[bucket].fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * Return the metrics as a JSON document
+ *
+ * The latency histogram lists the upper bound in nanoseconds and the
+ * count of the non empty buckets.
+ *
+ * @return	The JSON document
+ */
+string RuleMetrics::toJSON() const
+{
+	static const char *names[CounterCount] = {
+		"evaluations",
+		"parseErrors",
+		"compiles",
+		"compileErrors",
+		"invalidResults",
+		"droppedDatapoints",
+		"stateChanges",
+		"throttledReadings",
+		"parseAllocations"
+	};
+
+	string ret = "{ ";
+	for (int i = 0; i < CounterCount; i++)
+	{
+		ret += string("\"") + names[i] + "\": " +
+		       to_string(m_counters[i].load(memory_order_relaxed)) + ", ";
+	}
+
+	ret += "\"latency\": [ ";
+	bool first = true;
+	for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+	{
+		unsigned long count = m_latency[i].load(memory_order_relaxed);
+		if (!count)
+		{
+			continue;
+		}
+		if (!first)
+		{
+			ret += ", ";
+		}
+		first = false;
+		ret += "{ \"below\": ";
+		ret += i == METRICS_LATENCY_BUCKETS - 1 ?
+		       string("null") :
+		       to_string(2UL << i);
+		ret += ", \"count\": " + to_string(count) + " }";
+	}
+	ret += " ] }";
+
+	return ret;
+}
@@ -0,0 +1,184 @@
+/**
+ * FogLAMP SimpleExpression string index
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <string_index.h>
+
+using namespace std;
+
+/**
+ * Fold ASCII upper case letters to lower case
+ */
+static inline unsigned char fold(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/**
+ * Constructor
+ *
+ * @param    caseSensitive	False to match names ignoring the case,
+ *				as exprtk does for its symbols
+ */
+StringIndex::StringIndex(bool caseSensitive) : m_caseSensitive(caseSensitive),
+					       m_mask(0)
+{
+}
+
+/**
+ * Build the table for the given names: the position of each
+ * name in the vector is what find() returns
+ *
+ * The table is sized to at least twice the number of names, so
+ * probe sequences stay short.
+ *
+ * @param    keys	The names to index
+ */
+void StringIndex::build(const vector<string>& keys)
+{
+	m_keys = keys;
+	m_table.clear();
+	m_mask = 0;
+
+	if (m_keys.empty())
+	{
+		return;
+	}
+
+	size_t capacity = 4;
+	while (capacity < m_keys.size() * 2)
+	{
+		capacity <<= 1;
+	}
+	this->rehash(capacity);
+}
+
+/**
+ * Add a name to the table, unless already there
+ *
+ * The table doubles when it would be more than half full, so
+ * the cost is constant amortised.
+ *
+ * @param    key	The name, not necessarily null terminated
+ * @param    length	The name length
+ * @return		The position of the name
+ */
+int StringIndex::add(const char *key, size_t length)
+{
+	int position = this->find(key, length);
+	if (position >= 0)
+	{
+		return position;
+	}
+
+	m_keys.push_back(string(key, length));
+	if (m_keys.size() * 2 > m_table.size())
+	{
+		this->rehash(m_table.empty() ? 4 : m_table.size() * 2);
+		return m_keys.size() - 1;
+	}
+
+	uint32_t h = hash(key, length);
+	uint32_t bucket = h & m_mask;
+	while (m_table[bucket].position != -1)
+	{
+		bucket = (bucket + 1) & m_mask;
+	}
+	m_table[bucket].hash = h;
+	m_table[bucket].position = m_keys.size() - 1;
+	return m_keys.size() - 1;
+}
+
+/**
+ * Rebuild the table with the given capacity, a power of 2
+ */
+void StringIndex::rehash(size_t capacity)
+{
+	m_mask = capacity - 1;
+	m_table.assign(capacity, Entry{0, -1});
+
+	for (size_t i = 0; i < m_keys.size(); i++)
+	{
+		uint32_t h = hash(m_keys[i].c_str(), m_keys[i].length());
+		uint32_t bucket = h & m_mask;
+		while (m_table[bucket].position != -1)
+		{
+			bucket = (bucket + 1) & m_mask;
+		}
+		m_table[bucket].hash = h;
+		m_table[bucket].position = i;
+	}
+}
+
+/**
+ * Find a name in the table
+ *
+ * @param    key	The name, not necessarily null terminated
+ * @param    length	The name length
+ * @return		The position of the name or -1 if not found
+ */
+int StringIndex::find(const char *key, size_t length) const
+{
+	if (m_table.empty())
+	{
+		return -1;
+	}
+
+	uint32_t h = hash(key, length);
+	uint32_t bucket = h & m_mask;
+	while (m_table[bucket].position != -1)
+	{
+		const Entry& entry = m_table[bucket];
+		if (entry.hash == h &&
+		    equal(m_keys[entry.position], key, length))
+		{
+			return entry.position;
+		}
+		bucket = (bucket + 1) & m_mask;
+	}
+	return -1;
+}
+
+/**
+ * FNV-1a hash, folding the case when the index is case insensitive
+ */
+uint32_t StringIndex::hash(const char *key, size_t length) const
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char c = key[i];
+		h ^= m_caseSensitive ? c : fold(c);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+ * Compare an indexed name with a name of given length
+ */
+bool StringIndex::equal(const string& key, const char *other, size_t length) const
+{
+	if (key.length() != length)
+	{
+		return false;
+	}
+	if (m_caseSensitive)
+	{
+		return key.compare(0, length, other, length) == 0;
+	}
+	for (size_t i = 0; i < length; i++)
+	{
+		if (fold(key[i]) != fold(other[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
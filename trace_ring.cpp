@@ -0,0 +1,97 @@
+/**
+ * FogLAMP SimpleExpression evaluation tracing
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <trace_ring.h>
+
+using namespace std;
+
+/**
+ * Constructor
+ */
+TraceRing::TraceRing()
+{
+	for (auto &s : m_slots)
+	{
+		s.sequence.store(0, memory_order_relaxed);
+	}
+	m_head.store(0, memory_order_relaxed);
+}
+
+/**
+ * Add a traced evaluation, replacing the oldest one
+ *
+ * @param    sample	The stage durations
+ */
+void TraceRing::push(const TraceSample& sample)
+{
+	unsigned long head = m_head.load(memory_order_relaxed);
+	Slot& slot = m_slots[head % TRACE_RING_SIZE];
+
+	unsigned long sequence = slot.sequence.load(memory_order_relaxed);
+	slot.sequence.store(sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot.evaluation.store(sample.evaluation, memory_order_relaxed);
+	slot.parse.store(sample.parse, memory_order_relaxed);
+	slot.evaluate.store(sample.evaluate, memory_order_relaxed);
+	slot.state.store(sample.state, memory_order_relaxed);
+	slot.result.store(sample.result, memory_order_relaxed);
+
+	slot.sequence.store(sequence + 2, memory_order_release);
+	m_head.store(head + 1, memory_order_release);
+}
+
+/**
+ * Return the traced evaluations, oldest first, as a JSON document
+ *
+ * @return	The JSON document
+ */
+string TraceRing::toJSON() const
+{
+	unsigned long head = m_head.load(memory_order_acquire);
+	unsigned long count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+
+	string ret = "{ \"traces\": [ ";
+	bool first = true;
+	for (unsigned long i = head - count; i < head; i++)
+	{
+		const Slot& slot = m_slots[i % TRACE_RING_SIZE];
+
+		unsigned long before = slot.sequence.load(memory_order_acquire);
+		if (before & 1)
+		{
+			continue;
+		}
+		uint64_t evaluation = slot.evaluation.load(memory_order_relaxed);
+		uint64_t parse = slot.parse.load(memory_order_relaxed);
+		uint64_t evaluate = slot.evaluate.load(memory_order_relaxed);
+		uint64_t state = slot.state.load(memory_order_relaxed);
+		bool result = slot.result.load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		if (slot.sequence.load(memory_order_relaxed) != before)
+		{
+			continue;
+		}
+
+		if (!first)
+		{
+			ret += ", ";
+		}
+		first = false;
+		ret += "{ \"evaluation\": " + to_string(evaluation) +
+		       ", \"parse\": " + to_string(parse) +
+		       ", \"evaluate\": " + to_string(evaluate) +
+		       ", \"state\": " + to_string(state) +
+		       ", \"result\": " + (result ? "true" : "false") + " }";
+	}
+	ret += " ] }";
+
+	return ret;
+}
@@ -0,0 +1,826 @@
+/**
+ * FogLAMP SimpleExpression vectorised evaluation kernel
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <vector_kernel.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <float.h>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define VECTOR_KERNEL_NEON
+#endif
+
+using namespace std;
+
+/**
+ * Recursive descent parser of the expression subset the kernel
+ * supports, following exprtk precedence: "or" binds less than "and",
+ * which binds less than the comparison operators.
+ *
+ *   or_expr	:= and_expr { "or" and_expr }
+ *   and_expr	:= unary { "and" unary }
+ *   unary	:= "not" "(" or_expr ")" | "(" or_expr ")" | comparison
+ *   comparison	:= operand compare_op operand
+ *   operand	:= variable | [ "+" | "-" ] number
+ *
+ * Anything else makes the parse fail and the expression is left
+ * to exprtk.
+ */
+class KernelParser
+{
+	public:
+		KernelParser(const string& expression,
+			     const StringIndex& variables,
+			     vector<VectorKernel::Instruction>& program) :
+				m_text(expression.c_str()),
+				m_position(0),
+				m_variables(variables),
+				m_program(program)
+		{
+		};
+
+		bool	parse()
+		{
+			if (!orExpression())
+			{
+				return false;
+			}
+			skipSpaces();
+			return m_text[m_position] == '\0';
+		};
+
+	private:
+		struct Operand {
+			int	slot;
+			double	constant;
+		};
+
+		void	skipSpaces()
+		{
+			while (m_text[m_position] == ' ' ||
+			       m_text[m_position] == '\t' ||
+			       m_text[m_position] == '\r' ||
+			       m_text[m_position] == '\n')
+			{
+				m_position++;
+			}
+		};
+
+		static bool
+			isLetter(char c)
+		{
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+		};
+		static bool
+			isDigit(char c)
+		{
+			return c >= '0' && c <= '9';
+		};
+
+		// Match a case insensitive keyword not followed by a symbol character
+		bool	keyword(const char *word)
+		{
+			skipSpaces();
+			size_t length = strlen(word);
+			if (strncasecmp(m_text + m_position, word, length) != 0)
+			{
+				return false;
+			}
+			char next = m_text[m_position + length];
+			if (isLetter(next) || isDigit(next) || next == '_' || next == '.')
+			{
+				return false;
+			}
+			m_position += length;
+			return true;
+		};
+
+		bool	character(char c)
+		{
+			skipSpaces();
+			if (m_text[m_position] == c)
+			{
+				m_position++;
+				return true;
+			}
+			return false;
+		};
+
+		void	emit(VectorKernel::Opcode op)
+		{
+			VectorKernel::Instruction instruction;
+			instruction.op = op;
+			instruction.comparison = VectorKernel::CmpEqual;
+			instruction.lhs = -1;
+			instruction.rhs = -1;
+			instruction.constant = 0.0;
+			m_program.push_back(instruction);
+		};
+
+		bool	orExpression()
+		{
+			if (!andExpression())
+			{
+				return false;
+			}
+			while (keyword("or"))
+			{
+				if (!andExpression())
+				{
+					return false;
+				}
+				emit(VectorKernel::OpOr);
+			}
+			return true;
+		};
+
+		bool	andExpression()
+		{
+			if (!unary())
+			{
+				return false;
+			}
+			while (keyword("and"))
+			{
+				if (!unary())
+				{
+					return false;
+				}
+				emit(VectorKernel::OpAnd);
+			}
+			return true;
+		};
+
+		bool	unary()
+		{
+			if (keyword("not"))
+			{
+				if (!character('(') || !orExpression() || !character(')'))
+				{
+					return false;
+				}
+				emit(VectorKernel::OpNot);
+				return true;
+			}
+			if (character('('))
+			{
+				return orExpression() && character(')');
+			}
+			return comparison();
+		};
+
+		bool	compareOperator(VectorKernel::Comparison& comparison)
+		{
+			skipSpaces();
+			const char *p = m_text + m_position;
+			size_t length = 1;
+			if (p[0] == '<' && p[1] == '=')
+			{
+				comparison = VectorKernel::CmpLessEqual;
+				length = 2;
+			}
+			else if (p[0] == '<' && p[1] == '>')
+			{
+				comparison = VectorKernel::CmpNotEqual;
+				length = 2;
+			}
+			else if (p[0] == '>' && p[1] == '=')
+			{
+				comparison = VectorKernel::CmpGreaterEqual;
+				length = 2;
+			}
+			else if (p[0] == '=' && p[1] == '=')
+			{
+				comparison = VectorKernel::CmpEqual;
+				length = 2;
+			}
+			else if (p[0] == '!' && p[1] == '=')
+			{
+				comparison = VectorKernel::CmpNotEqual;
+				length = 2;
+			}
+			else if (p[0] == '<')
+			{
+				comparison = VectorKernel::CmpLess;
+			}
+			else if (p[0] == '>')
+			{
+				comparison = VectorKernel::CmpGreater;
+			}
+			else if (p[0] == '=')
+			{
+				comparison = VectorKernel::CmpEqual;
+			}
+			else
+			{
+				return false;
+			}
+			m_position += length;
+			return true;
+		};
+
+		bool	operand(Operand& value)
+		{
+			skipSpaces();
+			const char *start = m_text + m_position;
+			if (isLetter(*start))
+			{
+				size_t length = 1;
+				while (isLetter(start[length]) ||
+				       isDigit(start[length]) ||
+				       start[length] == '_' ||
+				       start[length] == '.')
+				{
+					length++;
+				}
+				// Constants, keywords and functions are left to exprtk
+				value.slot = m_variables.find(start, length);
+				value.constant = 0.0;
+				if (value.slot < 0)
+				{
+					return false;
+				}
+				m_position += length;
+				return true;
+			}
+
+			double sign = 1.0;
+			if (*start == '-' || *start == '+')
+			{
+				sign = (*start == '-') ? -1.0 : 1.0;
+				m_position++;
+				skipSpaces();
+				start = m_text + m_position;
+			}
+
+			// Decimal numbers only: digits, fraction and exponent
+			size_t length = 0;
+			while (isDigit(start[length]) || start[length] == '.')
+			{
+				length++;
+			}
+			if (!length)
+			{
+				return false;
+			}
+			if (start[length] == 'e' || start[length] == 'E')
+			{
+				length++;
+				if (start[length] == '+' || start[length] == '-')
+				{
+					length++;
+				}
+				if (!isDigit(start[length]))
+				{
+					return false;
+				}
+				while (isDigit(start[length]))
+				{
+					length++;
+				}
+			}
+			if (isLetter(start[length]) || start[length] == '_')
+			{
+				return false;
+			}
+
+			string number(start, length);
+			char *end;
+			value.constant = sign * strtod(number.c_str(), &end);
+			if (*end != '\0')
+			{
+				return false;
+			}
+			value.slot = -1;
+			m_position += length;
+			return true;
+		};
+
+		bool	comparison()
+		{
+			Operand lhs, rhs;
+			VectorKernel::Comparison comparison;
+			if (!operand(lhs) ||
+			    !compareOperator(comparison) ||
+			    !operand(rhs))
+			{
+				return false;
+			}
+
+			VectorKernel::Instruction instruction;
+			instruction.op = VectorKernel::OpCompare;
+			instruction.comparison = comparison;
+			instruction.constant = 0.0;
+			if (lhs.slot >= 0)
+			{
+				instruction.lhs = lhs.slot;
+				instruction.rhs = rhs.slot;
+				instruction.constant = rhs.constant;
+			}
+			else if (rhs.slot >= 0)
+			{
+				// constant op variable: swap the operands
+				instruction.lhs = rhs.slot;
+				instruction.rhs = -1;
+				instruction.constant = lhs.constant;
+				instruction.comparison = mirror(comparison);
+			}
+			else
+			{
+				return false;
+			}
+			m_program.push_back(instruction);
+			return true;
+		};
+
+		static VectorKernel::Comparison
+			mirror(VectorKernel::Comparison comparison)
+		{
+			switch (comparison)
+			{
+				case VectorKernel::CmpLess:
+					return VectorKernel::CmpGreater;
+				case VectorKernel::CmpLessEqual:
+					return VectorKernel::CmpGreaterEqual;
+				case VectorKernel::CmpGreater:
+					return VectorKernel::CmpLess;
+				case VectorKernel::CmpGreaterEqual:
+					return VectorKernel::CmpLessEqual;
+				default:
+					return comparison;
+			}
+		};
+
+	private:
+		const char		*m_text;
+		size_t			m_position;
+		const StringIndex&	m_variables;
+		vector<VectorKernel::Instruction>&
+					m_program;
+};
+
+/*
+ * Comparison operators: scalar and SIMD forms with the same IEEE
+ * semantics, ordered comparisons are false and "!=" is true when
+ * an operand is NaN, as the C++ operators exprtk uses.
+ * The SIMD forms are overloaded for double and float lanes.
+ */
+#define KERNEL_COMPARISON(NAME, OP, AVX_PREDICATE, SSE_PD, SSE_PS, NEON_F64, NEON_F32) \
+struct NAME \
+{ \
+	static bool scalar(double a, double b) { return a OP b; } \
+	KERNEL_COMPARISON_AVX(AVX_PREDICATE) \
+	KERNEL_COMPARISON_SSE(SSE_PD, SSE_PS) \
+	KERNEL_COMPARISON_NEON(NEON_F64, NEON_F32) \
+};
+
+#if defined(__AVX__)
+#define KERNEL_COMPARISON_AVX(PREDICATE) \
+	static __m256d avx(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, PREDICATE); } \
+	static __m256 avx(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, PREDICATE); }
+#else
+#define KERNEL_COMPARISON_AVX(PREDICATE)
+#endif
+
+#if defined(__SSE2__)
+#define KERNEL_COMPARISON_SSE(SSE_PD, SSE_PS) \
+	static __m128d sse(__m128d a, __m128d b) { return SSE_PD(a, b); } \
+	static __m128 sse(__m128 a, __m128 b) { return SSE_PS(a, b); }
+#else
+#define KERNEL_COMPARISON_SSE(SSE_PD, SSE_PS)
+#endif
+
+#if defined(VECTOR_KERNEL_NEON)
+static inline uint64x2_t vcneq_f64(float64x2_t a, float64x2_t b)
+{
+	return vreinterpretq_u64_u32(vmvnq_u32(vreinterpretq_u32_u64(vceqq_f64(a, b))));
+}
+static inline uint32x4_t vcneq_f32(float32x4_t a, float32x4_t b)
+{
+	return vmvnq_u32(vceqq_f32(a, b));
+}
+#define KERNEL_COMPARISON_NEON(NEON_F64, NEON_F32) \
+	static uint64x2_t neon(float64x2_t a, float64x2_t b) { return NEON_F64(a, b); } \
+	static uint32x4_t neon(float32x4_t a, float32x4_t b) { return NEON_F32(a, b); }
+#else
+#define KERNEL_COMPARISON_NEON(NEON_F64, NEON_F32)
+#endif
+
+KERNEL_COMPARISON(Less, <, _CMP_LT_OQ, _mm_cmplt_pd, _mm_cmplt_ps, vcltq_f64, vcltq_f32)
+KERNEL_COMPARISON(LessEqual, <=, _CMP_LE_OQ, _mm_cmple_pd, _mm_cmple_ps, vcleq_f64, vcleq_f32)
+KERNEL_COMPARISON(Greater, >, _CMP_GT_OQ, _mm_cmpgt_pd, _mm_cmpgt_ps, vcgtq_f64, vcgtq_f32)
+KERNEL_COMPARISON(GreaterEqual, >=, _CMP_GE_OQ, _mm_cmpge_pd, _mm_cmpge_ps, vcgeq_f64, vcgeq_f32)
+KERNEL_COMPARISON(Equal, ==, _CMP_EQ_OQ, _mm_cmpeq_pd, _mm_cmpeq_ps, vceqq_f64, vceqq_f32)
+KERNEL_COMPARISON(NotEqual, !=, _CMP_NEQ_UQ, _mm_cmpneq_pd, _mm_cmpneq_ps, vcneq_f64, vcneq_f32)
+
+/**
+ * Compare a column against a constant or another column,
+ * writing 1 or 0 for each row
+ */
+template <class Cmp, bool Constant>
+static void compareColumn(const double *lhs,
+			  const double *rhs,
+			  double constant,
+			  size_t rows,
+			  unsigned char *out)
+{
+	size_t i = 0;
+#if defined(__AVX__)
+	__m256d c = _mm256_set1_pd(constant);
+	for (; i + 4 <= rows; i += 4)
+	{
+		__m256d b = Constant ? c : _mm256_loadu_pd(rhs + i);
+		int mask = _mm256_movemask_pd(Cmp::avx(_mm256_loadu_pd(lhs + i), b));
+		out[i] = mask & 1;
+		out[i + 1] = (mask >> 1) & 1;
+		out[i + 2] = (mask >> 2) & 1;
+		out[i + 3] = (mask >> 3) & 1;
+	}
+#elif defined(__SSE2__)
+	__m128d c = _mm_set1_pd(constant);
+	for (; i + 2 <= rows; i += 2)
+	{
+		__m128d b = Constant ? c : _mm_loadu_pd(rhs + i);
+		int mask = _mm_movemask_pd(Cmp::sse(_mm_loadu_pd(lhs + i), b));
+		out[i] = mask & 1;
+		out[i + 1] = (mask >> 1) & 1;
+	}
+#elif defined(VECTOR_KERNEL_NEON)
+	float64x2_t c = vdupq_n_f64(constant);
+	for (; i + 2 <= rows; i += 2)
+	{
+		float64x2_t b = Constant ? c : vld1q_f64(rhs + i);
+		uint64x2_t mask = Cmp::neon(vld1q_f64(lhs + i), b);
+		out[i] = vgetq_lane_u64(mask, 0) & 1;
+		out[i + 1] = vgetq_lane_u64(mask, 1) & 1;
+	}
+#endif
+	for (; i < rows; i++)
+	{
+		out[i] = Cmp::scalar(lhs[i], Constant ? constant : rhs[i]);
+	}
+}
+
+/**
+ * Compare a single precision column against a constant or another
+ * column, the SIMD registers hold twice as many values
+ */
+template <class Cmp, bool Constant>
+static void compareColumn(const float *lhs,
+			  const float *rhs,
+			  float constant,
+			  size_t rows,
+			  unsigned char *out)
+{
+	size_t i = 0;
+#if defined(__AVX__)
+	__m256 c = _mm256_set1_ps(constant);
+	for (; i + 8 <= rows; i += 8)
+	{
+		__m256 b = Constant ? c : _mm256_loadu_ps(rhs + i);
+		int mask = _mm256_movemask_ps(Cmp::avx(_mm256_loadu_ps(lhs + i), b));
+		for (int lane = 0; lane < 8; lane++)
+		{
+			out[i + lane] = (mask >> lane) & 1;
+		}
+	}
+#elif defined(__SSE2__)
+	__m128 c = _mm_set1_ps(constant);
+	for (; i + 4 <= rows; i += 4)
+	{
+		__m128 b = Constant ? c : _mm_loadu_ps(rhs + i);
+		int mask = _mm_movemask_ps(Cmp::sse(_mm_loadu_ps(lhs + i), b));
+		out[i] = mask & 1;
+		out[i + 1] = (mask >> 1) & 1;
+		out[i + 2] = (mask >> 2) & 1;
+		out[i + 3] = (mask >> 3) & 1;
+	}
+#elif defined(VECTOR_KERNEL_NEON)
+	float32x4_t c = vdupq_n_f32(constant);
+	for (; i + 4 <= rows; i += 4)
+	{
+		float32x4_t b = Constant ? c : vld1q_f32(rhs + i);
+		uint32x4_t mask = Cmp::neon(vld1q_f32(lhs + i), b);
+		out[i] = vgetq_lane_u32(mask, 0) & 1;
+		out[i + 1] = vgetq_lane_u32(mask, 1) & 1;
+		out[i + 2] = vgetq_lane_u32(mask, 2) & 1;
+		out[i + 3] = vgetq_lane_u32(mask, 3) & 1;
+	}
+#endif
+	for (; i < rows; i++)
+	{
+		out[i] = Cmp::scalar(lhs[i], Constant ? constant : rhs[i]);
+	}
+}
+
+template <class Cmp, class T>
+static void compareColumn(const T *lhs,
+			  const T *rhs,
+			  T constant,
+			  size_t rows,
+			  unsigned char *out)
+{
+	if (rhs)
+	{
+		compareColumn<Cmp, false>(lhs, rhs, constant, rows, out);
+	}
+	else
+	{
+		compareColumn<Cmp, true>(lhs, rhs, constant, rows, out);
+	}
+}
+
+/**
+ * Run a comparison instruction
+ *
+ * @param    comparison	The comparison
+ * @param    lhs	The left operand column
+ * @param    rhs	The right operand column, NULL to compare
+ *			against the constant
+ * @param    constant	The constant
+ * @param    rows	The number of rows
+ * @param    out	Output, 1 where the comparison is true
+ */
+template <class T>
+static void compare(VectorKernel::Comparison comparison,
+		    const T *lhs,
+		    const T *rhs,
+		    T constant,
+		    size_t rows,
+		    unsigned char *out)
+{
+	switch (comparison)
+	{
+		case VectorKernel::CmpLess:
+			compareColumn<Less>(lhs, rhs, constant, rows, out);
+			break;
+		case VectorKernel::CmpLessEqual:
+			compareColumn<LessEqual>(lhs, rhs, constant, rows, out);
+			break;
+		case VectorKernel::CmpGreater:
+			compareColumn<Greater>(lhs, rhs, constant, rows, out);
+			break;
+		case VectorKernel::CmpGreaterEqual:
+			compareColumn<GreaterEqual>(lhs, rhs, constant, rows, out);
+			break;
+		case VectorKernel::CmpEqual:
+			compareColumn<Equal>(lhs, rhs, constant, rows, out);
+			break;
+		case VectorKernel::CmpNotEqual:
+			compareColumn<NotEqual>(lhs, rhs, constant, rows, out);
+			break;
+	}
+}
+
+static void compareInstruction(const VectorKernel::Instruction& instruction,
+			       const vector<vector<double> >& columns,
+			       size_t first,
+			       size_t rows,
+			       unsigned char *out)
+{
+	const double *lhs = columns[instruction.lhs].data() + first;
+	const double *rhs = instruction.rhs >= 0 ?
+			    columns[instruction.rhs].data() + first :
+			    NULL;
+	compare(instruction.comparison, lhs, rhs, instruction.constant, rows, out);
+}
+
+/**
+ * Run a comparison instruction on single precision columns
+ *
+ * The double constant is replaced by the float giving the same
+ * result for every float value: the nearest float above or below
+ * the constant, depending on the comparison. Equality with a
+ * constant no float represents is constant. The results are then
+ * those of the double comparison of the same values.
+ */
+static void compareInstruction(const VectorKernel::Instruction& instruction,
+			       const vector<vector<float> >& columns,
+			       size_t first,
+			       size_t rows,
+			       unsigned char *out)
+{
+	const float *lhs = columns[instruction.lhs].data() + first;
+	const float *rhs = instruction.rhs >= 0 ?
+			   columns[instruction.rhs].data() + first :
+			   NULL;
+	if (rhs)
+	{
+		compare(instruction.comparison, lhs, rhs, 0.0f, rows, out);
+		return;
+	}
+
+	double constant = instruction.constant;
+	float nearest;
+	if (std::isinf(constant) || fabs(constant) <= FLT_MAX)
+	{
+		nearest = (float) constant;
+	}
+	else
+	{
+		nearest = constant > 0.0 ? INFINITY : -INFINITY;
+	}
+	bool exact = (double) nearest == constant;
+	float below = nearest, above = nearest;
+	if (!exact && (double) nearest > constant)
+	{
+		below = nextafterf(nearest, -INFINITY);
+	}
+	else if (!exact)
+	{
+		above = nextafterf(nearest, INFINITY);
+	}
+
+	float value = nearest;
+	switch (instruction.comparison)
+	{
+		case VectorKernel::CmpLess:
+		case VectorKernel::CmpGreaterEqual:
+			value = above;
+			break;
+		case VectorKernel::CmpLessEqual:
+		case VectorKernel::CmpGreater:
+			value = below;
+			break;
+		case VectorKernel::CmpEqual:
+		case VectorKernel::CmpNotEqual:
+			if (!exact)
+			{
+				memset(out,
+				       instruction.comparison == VectorKernel::CmpNotEqual,
+				       rows);
+				return;
+			}
+			break;
+	}
+	compare(instruction.comparison, lhs, rhs, value, rows, out);
+}
+
+/**
+ * Constructor
+ */
+VectorKernel::VectorKernel() : m_depth(0)
+{
+}
+
+/**
+ * Compile the expression into a kernel program
+ *
+ * @param    expression	The expression
+ * @param    variables	The variable slot index of the Evaluator
+ * @return		False if the expression is outside the
+ *			supported subset
+ */
+bool VectorKernel::compile(const string& expression,
+			   const StringIndex& variables)
+{
+	m_program.clear();
+	KernelParser parser(expression, variables, m_program);
+	if (!parser.parse())
+	{
+		m_program.clear();
+		return false;
+	}
+
+	// Stack depth needed to run the program
+	size_t depth = 0;
+	m_depth = 0;
+	for (auto &instruction : m_program)
+	{
+		if (instruction.op == OpCompare)
+		{
+			depth++;
+		}
+		else if (instruction.op != OpNot)
+		{
+			depth--;
+		}
+		if (depth > m_depth)
+		{
+			m_depth = depth;
+		}
+	}
+	m_stack.resize(m_depth);
+
+	return true;
+}
+
+/**
+ * Evaluate the program over a batch of rows
+ *
+ * The stack is scratch data of the kernel: kernels evaluating parts
+ * of the same batch concurrently must be distinct copies.
+ *
+ * @param    columns	One array of values per variable slot
+ * @param    first	The first row to evaluate
+ * @param    rows	The number of rows
+ * @param    results	Output, 1 where the expression is true
+ */
+void VectorKernel::evaluate(const vector<vector<double> >& columns,
+			    size_t first,
+			    size_t rows,
+			    unsigned char *results)
+{
+	this->run(columns, first, rows, results);
+}
+
+/**
+ * Evaluate the program over a batch of single precision rows
+ *
+ * @param    columns	One array of values per variable slot
+ * @param    first	The first row to evaluate
+ * @param    rows	The number of rows
+ * @param    results	Output, 1 where the expression is true
+ */
+void VectorKernel::evaluate(const vector<vector<float> >& columns,
+			    size_t first,
+			    size_t rows,
+			    unsigned char *results)
+{
+	this->run(columns, first, rows, results);
+}
+
+/**
+ * Run the program on columns of doubles or floats
+ */
+template <class T>
+void VectorKernel::run(const vector<vector<T> >& columns,
+		       size_t first,
+		       size_t rows,
+		       unsigned char *results)
+{
+	if (!rows)
+	{
+		return;
+	}
+
+	for (auto &buffer : m_stack)
+	{
+		if (buffer.size() < rows)
+		{
+			buffer.resize(rows);
+		}
+	}
+
+	size_t top = 0;
+	for (auto &instruction : m_program)
+	{
+		switch (instruction.op)
+		{
+			case OpCompare:
+				compareInstruction(instruction,
+						   columns,
+						   first,
+						   rows,
+						   m_stack[top++].data());
+				break;
+			case OpAnd:
+			{
+				unsigned char *a = m_stack[top - 2].data();
+				const unsigned char *b = m_stack[top - 1].data();
+				for (size_t i = 0; i < rows; i++)
+				{
+					a[i] &= b[i];
+				}
+				top--;
+				break;
+			}
+			case OpOr:
+			{
+				unsigned char *a = m_stack[top - 2].data();
+				const unsigned char *b = m_stack[top - 1].data();
+				for (size_t i = 0; i < rows; i++)
+				{
+					a[i] |= b[i];
+				}
+				top--;
+				break;
+			}
+			case OpNot:
+			{
+				unsigned char *a = m_stack[top - 1].data();
+				for (size_t i = 0; i < rows; i++)
+				{
+					a[i] ^= 1;
+				}
+				break;
+			}
+		}
+	}
+
+	memcpy(results, m_stack[0].data(), rows);
+}
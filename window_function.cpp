@@ -0,0 +1,279 @@
+/**
+ * FogLAMP SimpleExpression windowed functions
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <window_function.h>
+#include <strings.h>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * Constructor
+ *
+ * @param    type	The function
+ * @param    seconds	The window duration, not used by rate and delta
+ * @param    maxSamples	The maximum number of samples in the window
+ */
+template<class T>
+WindowFunction<T>::WindowFunction(Type type,
+				  double seconds,
+				  size_t maxSamples) :
+				m_type(type),
+				m_seconds(seconds),
+				m_samples(maxSamples),
+				m_extremes(maxSamples),
+				m_reference(0.0),
+				m_sum(0.0),
+				m_sumSquares(0.0),
+				m_dropped(0),
+				m_sequence(0),
+				m_hasPrevious(false),
+				m_previousTimestamp(0.0),
+				m_previousValue(0.0)
+{
+}
+
+/**
+ * Return the function type of the given expression function name
+ *
+ * @param    name		The function name
+ * @param    type		Output function type
+ * @param    hasDuration	Set to true if the function takes
+ *				a window duration
+ * @return			False if the name is not a windowed function
+ */
+bool WindowFunctionBase::parseType(const string& name,
+				   Type& type,
+				   bool& hasDuration)
+{
+	static const struct {
+		const char	*name;
+		Type		type;
+		bool		hasDuration;
+	} functions[] = {
+		{ "window_avg",		WindowAvg,	true },
+		{ "window_min",		WindowMin,	true },
+		{ "window_max",		WindowMax,	true },
+		{ "window_stddev",	WindowStdDev,	true },
+		{ "rate",		Rate,		false },
+		{ "delta",		Delta,		false }
+	};
+
+	for (auto &f : functions)
+	{
+		if (strcasecmp(name.c_str(), f.name) == 0)
+		{
+			type = f.type;
+			hasDuration = f.hasDuration;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Add a sample and return the function value
+ *
+ * Timestamps going backwards are taken as the latest one seen,
+ * so that the window stays ordered. The value is rounded to T
+ * before it is used, so that the sums hold the stored samples.
+ *
+ * A NaN or infinite value is not added to the window: the function
+ * value of the samples already in the window is returned, NaN if
+ * there are none.
+ *
+ * @param    timestamp	The reading timestamp in seconds
+ * @param    value	The datapoint value
+ * @return		The function value including the sample
+ */
+template<class T>
+double WindowFunction<T>::update(double timestamp, double value)
+{
+	value = (T) value;
+
+	if (m_hasPrevious && timestamp < m_previousTimestamp)
+	{
+		timestamp = m_previousTimestamp;
+	}
+
+	if (m_type == Rate || m_type == Delta)
+	{
+		double result = 0.0;
+		if (m_hasPrevious)
+		{
+			result = value - m_previousValue;
+			if (m_type == Rate)
+			{
+				double elapsed = timestamp - m_previousTimestamp;
+				result = elapsed > 0.0 ? result / elapsed : 0.0;
+			}
+		}
+		m_hasPrevious = true;
+		m_previousTimestamp = timestamp;
+		m_previousValue = value;
+		return result;
+	}
+	m_hasPrevious = true;
+	m_previousTimestamp = timestamp;
+
+	// Make room and drop the samples out of the window
+	bool valid = std::isfinite(value);
+	if (valid && m_samples.full())
+	{
+		this->dropOldest();
+	}
+	while (!m_samples.empty() &&
+	       m_samples.front().timestamp <= timestamp - m_seconds)
+	{
+		this->dropOldest();
+	}
+	if (!valid)
+	{
+		return this->value();
+	}
+
+	Sample sample;
+	sample.timestamp = timestamp;
+	sample.value = value;
+	sample.sequence = m_sequence++;
+	if (m_samples.empty())
+	{
+		m_reference = value;
+	}
+	m_samples.push_back(sample);
+
+	switch (m_type)
+	{
+	case WindowMin:
+		while (!m_extremes.empty() && m_extremes.back().value >= value)
+		{
+			m_extremes.pop_back();
+		}
+		m_extremes.push_back(sample);
+		break;
+	case WindowMax:
+		while (!m_extremes.empty() && m_extremes.back().value <= value)
+		{
+			m_extremes.pop_back();
+		}
+		m_extremes.push_back(sample);
+		break;
+	default:
+		this->accumulate(value, 1.0);
+		break;
+	}
+
+	return this->value();
+}
+
+/**
+ * Return the function value of the samples in the window
+ *
+ * @return	The function value, NaN if the window is empty
+ */
+template<class T>
+double WindowFunction<T>::value() const
+{
+	if (m_samples.empty())
+	{
+		return NAN;
+	}
+	switch (m_type)
+	{
+	case WindowMin:
+	case WindowMax:
+		return m_extremes.front().value;
+	default:
+		break;
+	}
+
+	double count = (double) m_samples.size();
+	double offset = m_sum / count;
+	if (m_type == WindowAvg)
+	{
+		return m_reference + offset;
+	}
+
+	// Population standard deviation, rounding may get the
+	// variance slightly negative
+	double variance = m_sumSquares / count - offset * offset;
+	return variance > 0.0 ? sqrt(variance) : 0.0;
+}
+
+/**
+ * Remove the oldest sample from the window
+ */
+template<class T>
+void WindowFunction<T>::dropOldest()
+{
+	const Sample& oldest = m_samples.front();
+	if (!m_extremes.empty() &&
+	    (int32_t) (m_extremes.front().sequence - oldest.sequence) <= 0)
+	{
+		m_extremes.pop_front();
+	}
+	if (m_type != WindowAvg && m_type != WindowStdDev)
+	{
+		m_samples.pop_front();
+		return;
+	}
+
+	bool overflowed = this->accumulate(oldest.value, -1.0);
+	m_samples.pop_front();
+	if (++m_dropped >= m_samples.size() || overflowed)
+	{
+		this->recompute();
+	}
+}
+
+/**
+ * Add a sample to the sums, or remove it
+ *
+ * @param    value	The sample value
+ * @param    sign	1 to add the sample, -1 to remove it
+ * @return		True if the squared difference of the sample
+ *			overflows
+ */
+template<class T>
+bool WindowFunction<T>::accumulate(double value, double sign)
+{
+	double difference = value - m_reference;
+	double square = difference * difference;
+	m_sum += sign * difference;
+	m_sumSquares += sign * square;
+	return !std::isfinite(square);
+}
+
+/**
+ * Recompute the sums from the samples in the window, taking the
+ * newest one as the reference
+ *
+ * The cost is the window size, once per as many drops or per drop
+ * of a sample that overflowed, so that updates stay O(1) amortised.
+ */
+template<class T>
+void WindowFunction<T>::recompute()
+{
+	m_sum = 0.0;
+	m_sumSquares = 0.0;
+	m_dropped = 0;
+	if (m_samples.empty())
+	{
+		return;
+	}
+	m_reference = m_samples.back().value;
+	for (size_t i = 0; i < m_samples.size(); i++)
+	{
+		this->accumulate(m_samples[i].value, 1.0);
+	}
+}
+
+template class WindowFunction<double>;
+template class WindowFunction<float>;
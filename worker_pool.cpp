@@ -0,0 +1,139 @@
+/**
+ * FogLAMP SimpleExpression batch worker pool
+ *
+ * Copyright (c) 2019 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Amandeep Singh Arora, Massimiliano Pinto
+ */
+
+#include <worker_pool.h>
+
+using namespace std;
+
+/**
+ * Constructor
+ *
+ * @param    workers	The number of workers, the thread calling
+ *			run() included
+ */
+WorkerPool::WorkerPool(size_t workers) : m_work(NULL),
+					 m_tasks(0),
+					 m_generation(0),
+					 m_shutdown(false),
+					 m_next(0),
+					 m_running(0)
+{
+	for (size_t i = 1; i < workers; i++)
+	{
+		m_threads.push_back(thread(&WorkerPool::worker, this, i));
+	}
+}
+
+/**
+ * Destructor, waits for the pool threads to exit
+ */
+WorkerPool::~WorkerPool()
+{
+	{
+		lock_guard<mutex> guard(m_mutex);
+		m_shutdown = true;
+	}
+	m_start.notify_all();
+	for (auto &t : m_threads)
+	{
+		t.join();
+	}
+}
+
+/**
+ * Run the tasks of a job and return once all of them completed
+ *
+ * The work function is called once for each task number in
+ * [0, tasks), with the number of the worker running it in
+ * [0, getWorkerCount()): work run by the same worker is never
+ * concurrent, so the worker number can select per worker data.
+ * The calling thread is worker 0.
+ *
+ * @param    tasks	The number of tasks
+ * @param    work	The function running a task
+ */
+void WorkerPool::run(size_t tasks, const Work& work)
+{
+	if (m_threads.empty() || tasks < 2)
+	{
+		for (size_t i = 0; i < tasks; i++)
+		{
+			work(i, 0);
+		}
+		return;
+	}
+
+	{
+		lock_guard<mutex> guard(m_mutex);
+		m_work = &work;
+		m_tasks = tasks;
+		m_next = 0;
+		m_running = m_threads.size();
+		m_generation++;
+	}
+	m_start.notify_all();
+
+	this->runTasks(0);
+
+	// The job must outlive every worker using it
+	unique_lock<mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_running == 0; });
+	m_work = NULL;
+}
+
+/**
+ * Pool thread: run the tasks of each job until shutdown
+ *
+ * @param    worker	The worker number
+ */
+void WorkerPool::worker(size_t worker)
+{
+	unsigned long generation = 0;
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_start.wait(lock, [this, generation] {
+				return m_shutdown || m_generation != generation;
+			});
+			if (m_shutdown)
+			{
+				return;
+			}
+			generation = m_generation;
+		}
+
+		this->runTasks(worker);
+
+		bool last;
+		{
+			lock_guard<mutex> guard(m_mutex);
+			last = --m_running == 0;
+		}
+		if (last)
+		{
+			m_done.notify_one();
+		}
+	}
+}
+
+/**
+ * Take and run the tasks of the current job until none is left
+ *
+ * @param    worker	The worker number
+ */
+void WorkerPool::runTasks(size_t worker)
+{
+	size_t task;
+	while ((task = m_next.fetch_add(1)) < m_tasks)
+	{
+		(*m_work)(task, worker);
+	}
+}